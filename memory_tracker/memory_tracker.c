@@ -2,255 +2,7523 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <dlfcn.h>
 #include <execinfo.h>
 #include <time.h>
 #include <pthread.h>
+#include <sched.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
 #include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+#include <elf.h>
+#include <link.h>
+
+#ifdef MEMTRACK_HAVE_BFD
+// bfd.h refuses to be included without these autoconf macros
+#define PACKAGE "memtrack"
+#define PACKAGE_VERSION "1.0"
+#include <bfd.h>
+#endif
 
 #define MAX_ALLOCATIONS 100000
 #define MAX_BACKTRACE 16
-#define HASH_SIZE 10007
+#define TRACKER_FRAMES_MAX 8            // Own frames a capture may start with, unwound beyond MAX_BACKTRACE
+
+// Interned stack traces
+#define STACK_CHUNK_SHIFT 12            // Traces per chunk: 4096
+#define STACK_MAX_CHUNKS 4096           // Up to 16M distinct traces
+#define STACK_INDEX_INITIAL 4096        // Index slots, power of two
+#define TABLE_INITIAL_CAPACITY 1024   // Slots per shard, power of two
+#define TABLE_MAX_LOAD_PERCENT 70
+#define TABLE_MIGRATE_BATCH 32        // Old slots moved per table operation while resizing
+#define MAX_SHARDS 256
+#define PEAK_BATCH_BYTES 4096         // Net bytes a thread gathers before folding them into the process peak
+
+// Stack unwinding (MEMTRACK_UNWIND)
+#define CFI_CACHE_SIZE 4096             // Per-thread unwind rule cache, power of two
+#define CFI_STATE_STACK 8               // DW_CFA_remember_state nesting we support
+
+// Byte sampling (MEMTRACK_SAMPLE_BYTES)
+#define SAMPLE_FILTER_BITS 20           // Counting filter of sampled addresses: 1M counters
+
+// Aggregate mode (MEMTRACK_AGGREGATE=1): a block's slot packs its size
+// above its stack id instead of pointing at a record
+#define BLOCK_ID_BITS 24                // Covers every id the stack table can hand out
+#define BLOCK_API_BITS 4                // Allocation entry point
+#define BLOCK_SIZE_SHIFT (BLOCK_ID_BITS + BLOCK_API_BITS)
+#define BLOCK_MAX_SIZE ((1ull << (64 - BLOCK_SIZE_SHIFT)) - 1)
+
+// Periodic snapshots (MEMTRACK_SNAPSHOT_INTERVAL=seconds)
+#define SNAPSHOT_DEFAULT_GROWTH 5       // Consecutive growing snapshots before a callsite is reported
+#define SNAPSHOT_MAX_REPORTED 20        // Fastest-growing callsites printed per snapshot
+
+// Lifetime histograms (MEMTRACK_LIFETIMES=1)
+#define LIFETIME_BUCKETS 40             // Bucket b counts lifetimes in [2^(b-1), 2^b) ns; the last is open
+#define LIFETIME_MAX_REPORTED 20        // Callsites with the most frees printed in the report
+
+// realloc profiling (MEMTRACK_REALLOC=1)
+#define REALLOC_FACTOR_BUCKETS 6        // Growth factors: <1.125, <1.25, <1.5, <2, <4, larger
+#define REALLOC_MIN_GROWS 8             // Grows needed before a callsite's pattern is judged
+#define REALLOC_MIN_FACTOR 1.5          // Geometric growth below this is flagged
+#define REALLOC_STEP_BYTES 64           // Average growth at or below this is "an element at a time"
+#define REALLOC_MAX_REPORTED 20         // Callsites with the most bytes copied printed in the report
+
+// Cross-thread frees (MEMTRACK_THREADS=1)
+#define THREAD_INDEX_OVERFLOW 0xffff    // Shared index once 65534 threads have allocated
+#define THREAD_PAIR_SLOTS (1 << 16)     // (allocating thread, freeing thread, stack) counters, power of two
+#define THREAD_MAX_REPORTED 20          // Thread pairs and callsites printed in the report
+
+// Guard-page sampling (MEMTRACK_GUARD_RATE)
+#define GUARD_DEFAULT_SLOTS 64          // Blocks that can sit in the guarded pool at once
+#define GUARD_MAX_SLOTS 65536
+#define GUARD_MIN_ALIGNMENT 16          // malloc's alignment on x86-64
+
+// Free quarantine (MEMTRACK_QUARANTINE)
+#define QUARANTINE_MIN_BLOCKS 1024
+#define QUARANTINE_MAX_BLOCKS (1u << 18)
+#define QUARANTINE_DEFAULT_POISON 256   // Bytes poisoned and checked per block
+#define QUARANTINE_POISON 0xfd
+
+// Reachability leak check (MEMTRACK_REACHABILITY=1)
+#define REACH_MAX_THREADS 4096          // Threads whose stacks can be registered as roots
+#define REACH_TCB_BYTES 2304            // glibc's thread descriptor, if libc does not give its size
+#define REACH_BATCH 256                 // Regions per process_vm_readv
+#define REACH_CHUNK_BYTES (64 * 1024)   // Longest piece of a region read at once
+#define REACH_BUFFER_BYTES (1024 * 1024)
+#define REACH_MAX_WORKERS 64            // Scanning threads (MEMTRACK_REACH_THREADS, default online CPUs)
+#define REACH_PARALLEL_BLOCKS 65536     // Smaller heaps are scanned by the reporting thread alone
+#define REACH_DEQUE_SIZE (1 << 16)      // Blocks per work-stealing deque; the rest spill to a shared stack
+#define REACH_REGION_SHIFT 26           // Page map regions of 64 MB, hashed by address
+#define REACH_PAGE_SHIFT 12
+#define REACH_REGION_PAGES (1u << (REACH_REGION_SHIFT - REACH_PAGE_SHIFT))
+#define REACH_REGION_SLOTS (1u << 21)   // Enough for every region of a 47-bit address space
+#define REACH_COPY_SLICE (1 << 16)      // Table slots per copy task
+#define REACH_SORT_PAGES 4096           // Pages per sort task
+
+// Leak suppressions (MEMTRACK_SUPPRESSIONS)
+#define SUPPRESS_ALL_KINDS 0x1e         // One bit per leak class, 1 << reach_state_t
+#define SUPPRESS_MEMO_DONE 0x80
+
+// Shared live counters page (MEMTRACK_STATS)
+#define STATS_MAGIC "MEMSTATS"
+#define STATS_VERSION 1
+#define STATS_PAGE_SIZE 4096
+#define STATS_SIZE_CLASSES 32           // Class c holds requests in [2^(c-1), 2^c) bytes; the last is open
+#define STATS_DEFAULT_INTERVAL_MS 10    // Publishing period
+
+// Binary trace (MEMTRACK_TRACE=path)
+#define TRACE_MAGIC "MEMTRACE"
+#define TRACE_VERSION 1
+#define TRACE_HEADER_SIZE 4096          // Header page, chunks follow it
+#define TRACE_CHUNK_RECORDS 16384       // Records per thread chunk (768 KiB, page multiple)
+#define TRACE_SPARE_CHUNKS 64           // Partly used chunks kept from exited threads
+
+// Static arena for allocations made while dlsym resolves the real allocator
+#define BOOTSTRAP_ARENA_SIZE (1024 * 1024)
+
+// Buffered mode (MEMTRACK_BUFFERED=1) tuning
+#define EVENT_RING_SIZE 4096            // Events per thread buffer, power of two
+#define AGGREGATOR_INTERVAL_NS 1000000  // Aggregator drain period (1ms)
+#define PENDING_HASH_SIZE 1021
+#define MAX_STALL_PASSES 1000           // Drain passes before a blocked alloc is forced
+#define MAX_PENDING_PASSES 1000         // Drain passes before an unmatched free is reported
+
+// Metadata slab arena
+#define SLAB_CHUNK_SIZE (256 * 1024)    // Chunks are aligned to their size
+#define SLAB_MAGAZINE_SIZE 64           // Objects cached per thread and cache
+#define SLAB_BATCH 32                   // Objects moved between magazine and chunks at once
+
+// Thread-local storage in the static TLS block, so access never allocates
+#define THREAD_LOCAL __thread __attribute__((tls_model("initial-exec")))
+
+// Entry point a block was allocated through
+typedef enum {
+    API_MALLOC = 0,
+    API_CALLOC,
+    API_REALLOC,
+    API_REALLOCARRAY,
+    API_MEMALIGN,
+    API_POSIX_MEMALIGN,
+    API_ALIGNED_ALLOC,
+    API_VALLOC,
+    API_PVALLOC,
+    API_NEW,
+    API_NEW_ARRAY,
+    API_NEW_ALIGNED,
+    API_NEW_ARRAY_ALIGNED,
+    API_COUNT
+} alloc_api_t;
+
+// How a block was released; each allocation API expects exactly one
+typedef enum {
+    DEALLOC_FREE = 0,       // free() or realloc()
+    DEALLOC_DELETE,
+    DEALLOC_DELETE_ARRAY,
+    DEALLOC_DELETE_ALIGNED,
+    DEALLOC_DELETE_ARRAY_ALIGNED
+} dealloc_kind_t;
+
+typedef struct allocation {
+    void *ptr;
+    size_t size;
+    uint64_t birth_ns;      // CLOCK_MONOTONIC at allocation
+    uint32_t stack_id;      // Interned call stack, 0 if none
+    uint8_t api;            // alloc_api_t
+    uint16_t thread;        // Allocating thread's index with MEMTRACK_THREADS
+} allocation_t;
+
+// A deduplicated call stack; its position in the stack table is its id
+typedef struct {
+    uint64_t hash;
+    uint32_t depth;
+    void *frames[MAX_BACKTRACE];
+} stack_trace_t;
+
+// Open-addressing index from frame hash to stack id (0 = empty slot)
+typedef struct {
+    uint32_t *slots;
+    size_t capacity;        // Power of two
+} stack_index_t;
+
+// Counters for one call stack, kept in aggregate mode
+typedef struct {
+    size_t live_bytes;
+    size_t live_count;
+    size_t total_allocated;
+    size_t total_freed;
+    size_t allocation_count;
+    size_t free_count;
+    int api;                // Entry point of the latest allocation
+} callsite_t;
+
+// Freed blocks of one call stack by log2 lifetime in nanoseconds
+typedef struct {
+    size_t buckets[LIFETIME_BUCKETS];
+} lifetime_hist_t;
+
+// realloc() behaviour of one call stack, from the usable size of the old
+// block: a grow is a resize that did not fit in it
+typedef struct {
+    size_t count;           // Resizes of an existing block
+    size_t moves;           // ... that returned a different address
+    size_t bytes_copied;    // Old contents carried over by those moves
+    size_t grows;
+    size_t growth_bytes;    // Bytes added by grows
+    size_t growth_log2;     // Sum of log2(new / old) over grows, in 1/1024 units
+    size_t factors[REALLOC_FACTOR_BUCKETS];
+} realloc_stats_t;
+
+// Frees of blocks from one call stack, by allocating and freeing thread
+typedef struct {
+    uint64_t key;           // alloc thread << 48 | free thread << 32 | stack id, 0 = empty
+    size_t blocks;
+    size_t bytes;
+} thread_pair_t;
+
+// Global stack store. Lookups are lock-free; inserts take the lock.
+// Callsite counters are kept in aggregate mode and for snapshots.
+// Traces live in fixed chunks and never move, so ids stay valid.
+typedef struct {
+    pthread_mutex_t lock;
+    stack_index_t *index;
+    stack_trace_t *chunks[STACK_MAX_CHUNKS];
+    callsite_t *sites[STACK_MAX_CHUNKS];    // Parallel to chunks when callsite counters are kept
+    lifetime_hist_t *lifetimes[STACK_MAX_CHUNKS];   // Parallel to chunks with MEMTRACK_LIFETIMES
+    realloc_stats_t *reallocs[STACK_MAX_CHUNKS];    // Parallel to chunks with MEMTRACK_REALLOC
+    uint32_t count;         // Next id to hand out; id 0 is reserved
+} stack_table_t;
+
+// Open-addressing slot, keyed by the block address
+typedef struct {
+    uintptr_t ptr;
+    union {
+        allocation_t *alloc;    // Full record
+        uint64_t block;         // Aggregate mode: size << BLOCK_SIZE_SHIFT | api << BLOCK_ID_BITS | stack id
+    };
+} table_slot_t;
+
+#define SLOT_EMPTY 0
+#define SLOT_TOMBSTONE 1    // Only used in a table that is being migrated
+
+// Flat linear-probing table
+typedef struct {
+    table_slot_t *slots;
+    size_t capacity;        // Power of two
+    size_t count;
+} slot_table_t;
+
+// One independently locked slice of the live-allocation table
+typedef struct {
+    pthread_mutex_t mutex;
+    slot_table_t table;
+    slot_table_t old_table;     // Non-empty while a resize is in progress
+    size_t migrate_pos;
+    size_t total_allocated;
+    size_t total_freed;
+    size_t current_usage;
+    size_t allocation_count;
+    size_t free_count;
+    size_t live_by_class[STATS_SIZE_CLASSES];   // Kept with MEMTRACK_STATS
+    size_t allocs_by_class[STATS_SIZE_CLASSES];
+} __attribute__((aligned(64))) tracker_shard_t;
+
+typedef struct {
+    tracker_shard_t *shards;
+    unsigned int shard_count;   // Power of two
+} memory_tracker_t;
+
+// Shard counters summed on demand
+typedef struct {
+    size_t total_allocated;
+    size_t total_freed;
+    size_t peak_usage;
+    size_t current_usage;
+    size_t allocation_count;
+    size_t free_count;
+    size_t live_by_class[STATS_SIZE_CLASSES];
+    size_t allocs_by_class[STATS_SIZE_CLASSES];
+} tracker_totals_t;
+
+typedef enum {
+    UNWIND_BACKTRACE = 0,   // glibc backtrace()
+    UNWIND_FP,              // Frame-pointer chain
+    UNWIND_CFI              // .eh_frame rules, memoized per return address
+} unwind_mode_t;
+
+// How to find the caller's frame from a return address: the CFA is
+// cfa_reg + cfa_offset, the return address sits at CFA - 8 and, if
+// rbp_offset is non-zero, the caller's rbp was saved at CFA + rbp_offset
+typedef struct {
+    uintptr_t pc;
+    int32_t cfa_offset;
+    int16_t rbp_offset;
+    uint8_t cfa_reg;
+    uint8_t usable;
+} cfi_rule_t;
+
+typedef enum {
+    EVENT_ALLOC = 1,
+    EVENT_FREE = 2
+} event_type_t;
+
+// One allocation or free, as recorded by the application thread
+typedef struct {
+    uint8_t type;
+    uint8_t api;            // alloc_api_t for allocations, dealloc_kind_t for frees
+    uint16_t thread;        // Recording thread's index with MEMTRACK_THREADS
+    uint32_t stack_id;
+    void *ptr;
+    size_t size;
+    uint64_t clock_ns;      // CLOCK_MONOTONIC, orders events across buffers
+} tracker_event_t;
+
+// Single-producer/single-consumer event buffer owned by one thread.
+// The owner only advances head, the aggregator only advances tail.
+typedef struct event_ring {
+    unsigned long head __attribute__((aligned(64)));
+    unsigned long tail __attribute__((aligned(64)));
+    int orphaned;           // Owner thread has exited, ring can be reused
+    int stalled_passes;
+    struct event_ring *next;
+    tracker_event_t events[EVENT_RING_SIZE];
+} event_ring_t;
+
+// Free whose allocation has not been drained from another ring yet
+typedef struct pending_free {
+    void *ptr;
+    uint64_t clock_ns;
+    int passes;
+    int dealloc;
+    uint16_t thread;
+    struct pending_free *next;
+} pending_free_t;
+
+// Requests accepted by the control thread, by signal or over the socket
+typedef enum {
+    CONTROL_ON = 1,
+    CONTROL_OFF,
+    CONTROL_TOGGLE,
+    CONTROL_REPORT,
+    CONTROL_FLUSH,
+    CONTROL_COUNT
+} control_command_t;
+
+typedef enum {
+    TRACE_ALLOC = 1,
+    TRACE_FREE = 2,
+    TRACE_REALLOC = 3
+} trace_type_t;
+
+// One fixed-size record in the trace file. Slots never written stay zero
+// (type 0) and are skipped by readers.
+typedef struct {
+    uint64_t clock_ns;          // CLOCK_MONOTONIC
+    uint64_t ptr;               // Block allocated or freed; new block for realloc
+    uint64_t old_ptr;           // realloc: the block that was resized
+    uint64_t size;              // Requested size, 0 for frees
+    uint32_t tid;
+    uint32_t stack_id;          // Index into the stack section, 0 if none
+    uint32_t type;
+    uint32_t api;               // alloc_api_t, or dealloc_kind_t for frees
+} trace_record_t;
+
+// Start of the trace file. The stack and maps sections are appended after
+// the last chunk when the process exits.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t chunk_records;
+    uint32_t max_frames;
+    uint64_t pid;
+    uint64_t start_clock_ns;    // CLOCK_MONOTONIC when tracing started
+    uint64_t start_realtime_ns; // Wall clock at the same moment
+    uint64_t chunk_count;       // Chunks handed out so far
+    uint64_t stacks_offset;     // Array of trace_stack_t indexed by stack id
+    uint64_t stack_count;
+    uint64_t maps_offset;       // Copy of /proc/self/maps for symbolization
+    uint64_t maps_size;
+} trace_header_t;
+
+typedef struct {
+    uint32_t depth;
+    uint32_t reserved;
+    uint64_t frames[MAX_BACKTRACE];
+} trace_stack_t;
+
+typedef enum {
+    GUARD_UNUSED = 0,
+    GUARD_LIVE,
+    GUARD_FREED
+} guard_state_t;
+
+// Where a block came from and went, for guard and quarantine reports
+typedef struct {
+    uintptr_t ptr;
+    size_t size;
+    uint32_t alloc_stack;   // 0 if not known
+    uint32_t free_stack;
+    uint32_t alloc_tid;     // 0 if not known
+    uint32_t free_tid;
+} block_history_t;
+
+// One page of the guarded pool and the block it holds or last held
+typedef struct {
+    block_history_t block;
+    uint8_t state;          // guard_state_t
+} guard_slot_t;
+
+// One line of a guard fault report, built without stdio and sent with write()
+typedef struct {
+    char text[1280];
+    size_t length;
+} fault_line_t;
+
+// A freed block held back from the allocator; its first 'poisoned' bytes
+// are filled with QUARANTINE_POISON
+typedef struct {
+    block_history_t block;
+    size_t poisoned;
+} quarantine_entry_t;
+
+// A thread's roots for the reachability scan: its stack, and the static
+// TLS below its thread pointer plus the descriptor above it
+typedef struct {
+    uintptr_t stack_low;
+    uintptr_t stack_high;
+    uintptr_t thread_pointer;
+    int used;
+} reach_thread_t;
+
+// Value a collapsed-stack export gives each stack
+typedef enum {
+    EXPORT_INUSE_SPACE = 0,
+    EXPORT_INUSE_OBJECTS,
+    EXPORT_ALLOC_SPACE,     // Allocation totals need aggregate mode
+    EXPORT_ALLOC_OBJECTS,
+    EXPORT_VALUE_COUNT
+} export_value_t;
+
+// Reachability classes, weakest first. Marking only raises a block to
+// POSSIBLE or REACHABLE; blocks left UNSEEN are then split into DEFINITE
+// leaks and the INDIRECT ones only other leaked blocks point to.
+typedef enum {
+    REACH_UNSEEN = 0,
+    REACH_INDIRECT,
+    REACH_DEFINITE,
+    REACH_POSSIBLE,         // Only interior pointers lead to it
+    REACH_REACHABLE,
+    REACH_SUPPRESSED        // Report only: matched by a suppression for its class
+} reach_state_t;
+
+// Copy of a live block for the scan
+typedef struct {
+    uintptr_t start;
+    size_t size;
+    uint64_t birth_ns;
+    uint32_t stack_id;
+    uint8_t api;
+    uint8_t state;          // reach_state_t
+} reach_block_t;
+
+// Live counters published for external monitors. A single writer bumps
+// sequence to odd before updating and back to even after, so a reader
+// copies the page and retries if sequence changed or was odd.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t size_classes;
+    uint64_t pid;
+    uint64_t sequence;
+    uint64_t update_ns;         // CLOCK_MONOTONIC of the last publish
+    uint32_t exited;            // Final numbers, the process is exiting
+    uint32_t interval_ms;       // Publishing period
+    uint64_t total_allocated;
+    uint64_t total_freed;
+    uint64_t current_usage;
+    uint64_t peak_usage;        // Highest current_usage, within PEAK_BATCH_BYTES per thread
+    uint64_t allocation_count;
+    uint64_t free_count;
+    uint64_t live_by_class[STATS_SIZE_CLASSES];
+    uint64_t allocs_by_class[STATS_SIZE_CLASSES];
+} stats_page_t;
+
+// A chunk handed back by an exiting thread, with its first free record
+typedef struct {
+    uint64_t index;
+    uint32_t used;
+} trace_spare_t;
+
+// Header at the start of every slab chunk. Chunks are SLAB_CHUNK_SIZE
+// aligned, so an object finds its chunk by masking its address.
+typedef struct slab_chunk {
+    struct slab_chunk *prev;
+    struct slab_chunk *next;
+    struct slab_chunk *chunk_prev;  // Every chunk of the cache, full ones included
+    struct slab_chunk *chunk_next;
+    void *free_list;
+    char *bump;             // Start of never-used space
+    char *end;
+    unsigned int in_use;    // Objects handed out, including those in magazines
+    int on_partial;
+} slab_chunk_t;
+
+// Fixed-size object cache backed by mmap'd chunks
+typedef struct {
+    pthread_mutex_t lock;
+    size_t object_size;
+    int magazine;           // Index into thread_magazines
+    slab_chunk_t *partial;  // Chunks with free objects
+    slab_chunk_t *spare;    // One empty chunk kept to absorb churn
+    slab_chunk_t *chunks;   // All mapped chunks, so a forked child can drop them
+} slab_cache_t;
+
+// Per-thread stash of free objects, refilled and drained in batches
+typedef struct {
+    unsigned int count;
+    void *objects[SLAB_MAGAZINE_SIZE];
+} slab_magazine_t;
+
+#define SLAB_CACHE_COUNT 2
+
+static memory_tracker_t tracker = {0};
+static long process_usage = 0;      // Live bytes over all shards, less what threads still batch
+static long process_peak = 0;       // Highest process_usage seen
+static stack_table_t stack_table = { PTHREAD_MUTEX_INITIALIZER, NULL, {NULL}, {NULL}, {NULL}, {NULL}, 1 };
+static int initialized = 0;
+static int tracking_enabled = 0;    // Turned on once initialization succeeds, then by MEMTRACK_CONTROL
+static int tracking_restarted = 0;  // Tracking was switched back on, so frees of older blocks are expected
+static int buffered_mode = 0;
+static int aggregate_mode = 0;
+static double snapshot_interval = 0;            // Seconds between snapshots, 0 = off
+static unsigned int snapshot_growth = SNAPSHOT_DEFAULT_GROWTH;
+static int lifetime_mode = 0;
+static int realloc_mode = 0;
+
+// Cross-thread frees: threads get small indices in order of their first
+// tracked event, and frees count into a lock-free table of thread pairs
+static int thread_mode = 0;
+static uint32_t thread_index_count = 0;
+static uint32_t *thread_index_tids = NULL;  // Kernel tid by index
+static thread_pair_t *thread_pairs = NULL;
+static size_t thread_pairs_dropped = 0;     // Frees not counted because the table was full
+static THREAD_LOCAL uint16_t thread_index = 0;
+
+// Monotonic clock reading paired with the wall clock, to print birth times
+static uint64_t clock_origin_ns = 0;
+static time_t clock_origin_time = 0;
+static int unwind_mode = UNWIND_BACKTRACE;
+static uintptr_t self_text_start = 0;  // The tracker's own code, stripped from the top of captured stacks
+static uintptr_t self_text_end = 0;
+
+// Sampling: mean bytes between samples (0 = record everything) and a
+// counting filter of addresses that may be sampled, so frees of unsampled
+// blocks skip the table
+static double sample_interval = 0;
+static uint8_t *sample_filter = NULL;
+static THREAD_LOCAL int64_t bytes_until_sample = 0;
+static THREAD_LOCAL uint64_t sample_rng = 0;
+
+// Binary trace state. Each thread appends to its own mapped chunk of the
+// file; only handing out chunks takes trace_lock.
+static int trace_fd = -1;
+static const char *trace_path = NULL;   // MEMTRACK_TRACE, kept to name a forked child's trace
+static trace_header_t *trace_header = NULL;
+static int trace_closed = 0;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_spare_t trace_spares[TRACE_SPARE_CHUNKS];
+static int trace_spare_count = 0;
+static THREAD_LOCAL trace_record_t *trace_pos = NULL;
+static THREAD_LOCAL trace_record_t *trace_end = NULL;
+static THREAD_LOCAL uint64_t thread_trace_chunk = 0;
+static THREAD_LOCAL uint32_t thread_tid = 0;
+static THREAD_LOCAL long thread_usage_batch = 0;   // Net bytes not yet added to process_usage
+
+// Guarded pool (MEMTRACK_GUARD_RATE). Slot pages alternate with pages that
+// are never accessible; a slot page is readable only while its block is
+// live, so overflows and use after free fault on the spot.
+static char *guard_pool = NULL;
+static char *guard_pool_end = NULL;
+static size_t guard_page_size = 0;
+static unsigned long guard_rate = 0;        // One allocation in guard_rate on average
+static unsigned int guard_slot_count = 0;
+static guard_slot_t *guard_slots = NULL;
+static uint32_t *guard_queue = NULL;        // Slots in reuse order: never used, then oldest freed
+static unsigned int guard_queue_head = 0;
+static unsigned int guard_queue_count = 0;
+static size_t guard_sampled = 0;
+static pthread_mutex_t guard_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sigaction guard_previous_segv;
+static THREAD_LOCAL long guard_countdown = 0;
+static THREAD_LOCAL uint64_t guard_rng = 0;
+
+// Free quarantine (MEMTRACK_QUARANTINE). Freed blocks wait in a FIFO ring
+// before going back to malloc; the index maps a held block to its ring
+// position so a second free is caught.
+static size_t quarantine_budget = 0;        // Bytes held at most
+static size_t quarantine_poison = QUARANTINE_DEFAULT_POISON;
+static quarantine_entry_t *quarantine_ring = NULL;
+static size_t quarantine_capacity = 0;      // Power of two
+static size_t quarantine_head = 0;          // Oldest entry
+static size_t quarantine_count = 0;
+static size_t quarantine_bytes = 0;
+static slot_table_t quarantine_index;
+static size_t quarantine_evicted = 0;
+static size_t quarantine_errors = 0;
+static pthread_mutex_t quarantine_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Reachability leak check (MEMTRACK_REACHABILITY). Threads register their
+// stacks on their first tracked call, as the report cannot find them.
+static int reach_mode = 0;
+static reach_thread_t *reach_threads = NULL;
+static size_t reach_threads_missed = 0;
+static reach_thread_t reach_unregistered;  // Where threads that found no free entry point
+static THREAD_LOCAL reach_thread_t *thread_reach = NULL;
+
+// Shared counters page (MEMTRACK_STATS), written by its publisher thread
+static stats_page_t *stats_page = NULL;
+static const char *stats_spec = NULL;   // MEMTRACK_STATS, kept to name a forked child's page
+static char stats_path[256];
+static long stats_interval_ms = STATS_DEFAULT_INTERVAL_MS;
+static pthread_t stats_thread;
+static int stats_running = 0;
+static int stats_stop = 0;
+
+// Profile exports (MEMTRACK_COLLAPSED, MEMTRACK_PPROF), rewritten with
+// every report
+static const char *collapsed_spec = NULL;   // Kept to name a forked child's files
+static const char *pprof_spec = NULL;
+static char collapsed_path[256];
+static char pprof_path[256];
+static int collapsed_value = EXPORT_INUSE_SPACE;
+
+// Runtime control channel (MEMTRACK_CONTROL)
+static int control_pipe[2] = { -1, -1 };
+static int control_socket = -1;
+static const char *control_spec = NULL; // MEMTRACK_CONTROL, kept for forked children
+static const char *control_path = NULL;
+static char child_control_path[256];
+static int control_stopped = 0;
+static pthread_mutex_t control_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Fork handling: every lock is held across fork(), and a child opens its
+// own outputs and restarts helper threads on its first tracked call
+static int fork_locked = 0;
+static int fork_child_pending = 0;
+
+// Serializes report symbolization, which shares the module and address caches
+static pthread_mutex_t symbolizer_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Set while the tracker itself runs on this thread, so allocations made by
+// backtrace(), stdio or the aggregator are passed through untracked
+static THREAD_LOCAL int in_tracker = 0;
+
+// Buffered mode state
+static THREAD_LOCAL event_ring_t *thread_ring = NULL;
+static THREAD_LOCAL int thread_exiting = 0;
+static THREAD_LOCAL int thread_registered = 0;
+static THREAD_LOCAL uintptr_t thread_stack_low = 0;
+static THREAD_LOCAL uintptr_t thread_stack_high = 0;
+static THREAD_LOCAL cfi_rule_t *thread_cfi_cache = NULL;
+static pthread_key_t thread_key;
+static event_ring_t *ring_list = NULL;
+static pthread_mutex_t drain_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pending_free_t *pending_frees[PENDING_HASH_SIZE];
+static pthread_t aggregator_thread;
+static int aggregator_running = 0;
+static int aggregator_stop = 0;
+
+// Bootstrap allocator. Until init_tracker has resolved the real allocator
+// the real_* pointers lead to these stand-ins: the first call anywhere runs
+// initialization, and calls made while dlsym itself is resolving symbols
+// are served from a static arena that is never reused or released.
+static void init_tracker(void);
+
+static char bootstrap_arena[BOOTSTRAP_ARENA_SIZE] __attribute__((aligned(4096)));
+static size_t bootstrap_used = 0;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static THREAD_LOCAL int in_bootstrap = 0;
+
+static void *bootstrap_malloc(size_t size);
+static void bootstrap_free(void *ptr);
+static void *bootstrap_calloc(size_t nmemb, size_t size);
+static void *bootstrap_realloc(void *ptr, size_t size);
+static int bootstrap_posix_memalign(void **memptr, size_t alignment, size_t size);
+static void *bootstrap_aligned_alloc(size_t alignment, size_t size);
+static void *bootstrap_memalign(size_t alignment, size_t size);
+static void *bootstrap_valloc(size_t size);
+static void *bootstrap_pvalloc(size_t size);
+static size_t bootstrap_malloc_usable_size(void *ptr);
+
+// Function pointers for original malloc/free
+static void* (*real_malloc)(size_t size) = bootstrap_malloc;
+static void (*real_free)(void *ptr) = bootstrap_free;
+static void* (*real_calloc)(size_t nmemb, size_t size) = bootstrap_calloc;
+static void* (*real_realloc)(void *ptr, size_t size) = bootstrap_realloc;
+static int (*real_posix_memalign)(void **memptr, size_t alignment, size_t size) = bootstrap_posix_memalign;
+static void* (*real_aligned_alloc)(size_t alignment, size_t size) = bootstrap_aligned_alloc;
+static void* (*real_memalign)(size_t alignment, size_t size) = bootstrap_memalign;
+static void* (*real_valloc)(size_t size) = bootstrap_valloc;
+static void* (*real_pvalloc)(size_t size) = bootstrap_pvalloc;
+static size_t (*real_malloc_usable_size)(void *ptr) = bootstrap_malloc_usable_size;
+
+static int is_bootstrap(void *ptr) {
+    return (char *)ptr >= bootstrap_arena && (char *)ptr < bootstrap_arena + BOOTSTRAP_ARENA_SIZE;
+}
+
+// Carve an aligned block, with its size stored just below it
+static void *bootstrap_alloc(size_t size, size_t alignment) {
+    if (alignment < 16) alignment = 16;
+
+    size_t used = __atomic_load_n(&bootstrap_used, __ATOMIC_RELAXED);
+    size_t start;
+    do {
+        start = (used + sizeof(size_t) + alignment - 1) & ~(alignment - 1);
+        if (start > BOOTSTRAP_ARENA_SIZE || size > BOOTSTRAP_ARENA_SIZE - start) return NULL;
+    } while (!__atomic_compare_exchange_n(&bootstrap_used, &used, start + size, 1,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    ((size_t *)(bootstrap_arena + start))[-1] = size;
+    return bootstrap_arena + start;
+}
+
+static size_t bootstrap_size(void *ptr) {
+    return ((size_t *)ptr)[-1];
+}
+
+// Initialize unless this thread is the one initializing; other threads
+// wait in pthread_once. Returns 1 once the real allocator can be called.
+static int bootstrap_resolve(void) {
+    if (in_bootstrap) return 0;
+    pthread_once(&init_once, init_tracker);
+    return real_malloc != bootstrap_malloc;
+}
+
+static void *bootstrap_malloc(size_t size) {
+    if (bootstrap_resolve()) return real_malloc(size);
+    return bootstrap_alloc(size, 16);
+}
+
+static void bootstrap_free(void *ptr) {
+    if (!is_bootstrap(ptr) && bootstrap_resolve()) real_free(ptr);
+}
+
+// Arena memory starts zeroed and is never reused
+static void *bootstrap_calloc(size_t nmemb, size_t size) {
+    if (bootstrap_resolve()) return real_calloc(nmemb, size);
+
+    size_t bytes;
+    if (__builtin_mul_overflow(nmemb, size, &bytes)) return NULL;
+    return bootstrap_alloc(bytes, 16);
+}
+
+static void *bootstrap_realloc(void *ptr, size_t size) {
+    if (bootstrap_resolve()) return real_realloc(ptr, size);
+
+    void *new_ptr = bootstrap_alloc(size, 16);
+    if (new_ptr && ptr) {
+        size_t old_size = bootstrap_size(ptr);
+        memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    }
+    return new_ptr;
+}
+
+static void *bootstrap_memalign(size_t alignment, size_t size) {
+    if (bootstrap_resolve()) return real_memalign ? real_memalign(alignment, size) : NULL;
+    return bootstrap_alloc(size, alignment);
+}
+
+static int bootstrap_posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (bootstrap_resolve()) {
+        return real_posix_memalign ? real_posix_memalign(memptr, alignment, size) : ENOMEM;
+    }
+    *memptr = bootstrap_alloc(size, alignment);
+    return *memptr ? 0 : ENOMEM;
+}
+
+static void *bootstrap_aligned_alloc(size_t alignment, size_t size) {
+    if (bootstrap_resolve()) return real_aligned_alloc ? real_aligned_alloc(alignment, size) : NULL;
+    return bootstrap_alloc(size, alignment);
+}
+
+static void *bootstrap_valloc(size_t size) {
+    if (bootstrap_resolve()) return real_valloc ? real_valloc(size) : NULL;
+    return bootstrap_alloc(size, 4096);
+}
+
+static void *bootstrap_pvalloc(size_t size) {
+    if (bootstrap_resolve()) return real_pvalloc ? real_pvalloc(size) : NULL;
+    return bootstrap_alloc((size + 4095) & ~(size_t)4095, 4096);
+}
+
+static size_t bootstrap_malloc_usable_size(void *ptr) {
+    if (bootstrap_resolve()) return real_malloc_usable_size ? real_malloc_usable_size(ptr) : 0;
+    return ptr ? bootstrap_size(ptr) : 0;
+}
+
+static const char *const api_names[API_COUNT] = {
+    "malloc", "calloc", "realloc", "reallocarray", "memalign", "posix_memalign",
+    "aligned_alloc", "valloc", "pvalloc", "operator new", "operator new[]",
+    "aligned operator new", "aligned operator new[]"
+};
+
+// Symbol of each entry point as memcheck names it in stacks
+static const char *const api_symbols[API_COUNT] = {
+    "malloc", "calloc", "realloc", "reallocarray", "memalign", "posix_memalign",
+    "aligned_alloc", "valloc", "pvalloc", "_Znwm", "_Znam",
+    "_ZnwmSt11align_val_t", "_ZnamSt11align_val_t"
+};
+
+static const char *const dealloc_names[] = {
+    "free", "operator delete", "operator delete[]",
+    "aligned operator delete", "aligned operator delete[]"
+};
+
+// The release each allocation API must be paired with
+static const uint8_t api_dealloc[API_COUNT] = {
+    DEALLOC_FREE, DEALLOC_FREE, DEALLOC_FREE, DEALLOC_FREE, DEALLOC_FREE, DEALLOC_FREE,
+    DEALLOC_FREE, DEALLOC_FREE, DEALLOC_FREE, DEALLOC_DELETE, DEALLOC_DELETE_ARRAY,
+    DEALLOC_DELETE_ALIGNED, DEALLOC_DELETE_ARRAY_ALIGNED
+};
+
+// Slab caches for tracker metadata, kept out of the application heap
+static slab_cache_t record_cache = {
+    PTHREAD_MUTEX_INITIALIZER, (sizeof(allocation_t) + 15) & ~(size_t)15, 0, NULL, NULL, NULL
+};
+static slab_cache_t pending_cache = {
+    PTHREAD_MUTEX_INITIALIZER, (sizeof(pending_free_t) + 15) & ~(size_t)15, 1, NULL, NULL, NULL
+};
+static THREAD_LOCAL slab_magazine_t thread_magazines[SLAB_CACHE_COUNT];
+
+static void release_thread_state(void *arg);
+
+// Make sure release_thread_state runs when the calling thread exits
+static void register_thread(void) {
+    if (thread_registered || !initialized) return;
+    thread_registered = 1;
+    pthread_setspecific(thread_key, &thread_registered);
+}
+
+static slab_chunk_t *slab_chunk_of(void *object) {
+    return (slab_chunk_t *)((uintptr_t)object & ~((uintptr_t)SLAB_CHUNK_SIZE - 1));
+}
+
+static void slab_unlink(slab_cache_t *cache, slab_chunk_t *chunk) {
+    if (chunk->prev) chunk->prev->next = chunk->next;
+    else cache->partial = chunk->next;
+    if (chunk->next) chunk->next->prev = chunk->prev;
+    chunk->prev = chunk->next = NULL;
+    chunk->on_partial = 0;
+}
+
+static void slab_link(slab_cache_t *cache, slab_chunk_t *chunk) {
+    chunk->prev = NULL;
+    chunk->next = cache->partial;
+    if (cache->partial) cache->partial->prev = chunk;
+    cache->partial = chunk;
+    chunk->on_partial = 1;
+}
+
+// Map a new chunk aligned to SLAB_CHUNK_SIZE (caller holds cache->lock)
+static slab_chunk_t *slab_map_chunk(slab_cache_t *cache) {
+    char *raw = mmap(NULL, SLAB_CHUNK_SIZE * 2, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) return NULL;
+
+    // Trim the misaligned head and the unused tail
+    char *base = (char *)(((uintptr_t)raw + SLAB_CHUNK_SIZE - 1) & ~((uintptr_t)SLAB_CHUNK_SIZE - 1));
+    if (base > raw) munmap(raw, base - raw);
+    munmap(base + SLAB_CHUNK_SIZE, raw + SLAB_CHUNK_SIZE - base);
+
+    slab_chunk_t *chunk = (slab_chunk_t *)base;
+    size_t header = (sizeof(slab_chunk_t) + cache->object_size - 1) / cache->object_size * cache->object_size;
+    chunk->free_list = NULL;
+    chunk->bump = base + header;
+    chunk->end = base + SLAB_CHUNK_SIZE - (SLAB_CHUNK_SIZE - header) % cache->object_size;
+    chunk->in_use = 0;
+    chunk->chunk_prev = NULL;
+    chunk->chunk_next = cache->chunks;
+    if (cache->chunks) cache->chunks->chunk_prev = chunk;
+    cache->chunks = chunk;
+    slab_link(cache, chunk);
+    return chunk;
+}
+
+// Move up to 'want' objects into a magazine (caller holds cache->lock)
+static unsigned int slab_refill(slab_cache_t *cache, void **out, unsigned int want) {
+    unsigned int got = 0;
+
+    while (got < want) {
+        slab_chunk_t *chunk = cache->partial;
+        if (!chunk) {
+            if (cache->spare) {
+                chunk = cache->spare;
+                cache->spare = NULL;
+                slab_link(cache, chunk);
+            } else if (!(chunk = slab_map_chunk(cache))) {
+                break;
+            }
+        }
+
+        while (got < want) {
+            void *object;
+            if (chunk->free_list) {
+                object = chunk->free_list;
+                chunk->free_list = *(void **)object;
+            } else if (chunk->bump < chunk->end) {
+                object = chunk->bump;
+                chunk->bump += cache->object_size;
+            } else {
+                break;
+            }
+            chunk->in_use++;
+            out[got++] = object;
+        }
+
+        if (!chunk->free_list && chunk->bump >= chunk->end) {
+            slab_unlink(cache, chunk);
+        }
+    }
+    return got;
+}
+
+// Return an object to its chunk and unmap chunks that become empty,
+// keeping one spare (caller holds cache->lock)
+static void slab_release(slab_cache_t *cache, void *object) {
+    slab_chunk_t *chunk = slab_chunk_of(object);
+
+    *(void **)object = chunk->free_list;
+    chunk->free_list = object;
+    chunk->in_use--;
+    if (!chunk->on_partial) {
+        slab_link(cache, chunk);
+    }
+
+    if (chunk->in_use == 0) {
+        slab_unlink(cache, chunk);
+        if (!cache->spare) {
+            cache->spare = chunk;
+        } else {
+            if (chunk->chunk_prev) chunk->chunk_prev->chunk_next = chunk->chunk_next;
+            else cache->chunks = chunk->chunk_next;
+            if (chunk->chunk_next) chunk->chunk_next->chunk_prev = chunk->chunk_prev;
+            munmap(chunk, SLAB_CHUNK_SIZE);
+        }
+    }
+}
+
+static void *slab_alloc(slab_cache_t *cache) {
+    void *object = NULL;
+
+    if (thread_exiting) {
+        // Past the thread destructor: no magazine to flush later
+        pthread_mutex_lock(&cache->lock);
+        slab_refill(cache, &object, 1);
+        pthread_mutex_unlock(&cache->lock);
+        return object;
+    }
+
+    slab_magazine_t *magazine = &thread_magazines[cache->magazine];
+    if (magazine->count == 0) {
+        register_thread();
+        pthread_mutex_lock(&cache->lock);
+        magazine->count = slab_refill(cache, magazine->objects, SLAB_BATCH);
+        pthread_mutex_unlock(&cache->lock);
+        if (magazine->count == 0) return NULL;
+    }
+    return magazine->objects[--magazine->count];
+}
+
+static void slab_free(slab_cache_t *cache, void *object) {
+    if (!object) return;
+
+    if (thread_exiting) {
+        pthread_mutex_lock(&cache->lock);
+        slab_release(cache, object);
+        pthread_mutex_unlock(&cache->lock);
+        return;
+    }
+
+    slab_magazine_t *magazine = &thread_magazines[cache->magazine];
+    if (magazine->count == SLAB_MAGAZINE_SIZE) {
+        pthread_mutex_lock(&cache->lock);
+        while (magazine->count > SLAB_MAGAZINE_SIZE - SLAB_BATCH) {
+            slab_release(cache, magazine->objects[--magazine->count]);
+        }
+        pthread_mutex_unlock(&cache->lock);
+    }
+    magazine->objects[magazine->count++] = object;
+}
+
+// Give every object cached by this thread back to its chunk
+static void slab_flush_thread(void) {
+    slab_cache_t *caches[SLAB_CACHE_COUNT] = { &record_cache, &pending_cache };
+
+    for (int i = 0; i < SLAB_CACHE_COUNT; i++) {
+        slab_magazine_t *magazine = &thread_magazines[caches[i]->magazine];
+        pthread_mutex_lock(&caches[i]->lock);
+        while (magazine->count > 0) {
+            slab_release(caches[i], magazine->objects[--magazine->count]);
+        }
+        pthread_mutex_unlock(&caches[i]->lock);
+    }
+}
+
+// Unmap every chunk of a cache at once, objects and magazine included. A
+// forked child uses this to shed the parent's records: unmapping only
+// reads the chunk headers, so pages still shared with the parent are not
+// copied first (caller holds cache->lock).
+static void slab_drop_all(slab_cache_t *cache) {
+    slab_chunk_t *chunk = cache->chunks;
+    while (chunk) {
+        slab_chunk_t *next = chunk->chunk_next;
+        munmap(chunk, SLAB_CHUNK_SIZE);
+        chunk = next;
+    }
+    cache->chunks = NULL;
+    cache->partial = NULL;
+    cache->spare = NULL;
+    thread_magazines[cache->magazine].count = 0;
+}
+
+// Hash function for allocation tracking (64-bit murmur finalizer)
+static uint64_t hash_ptr(uintptr_t addr) {
+    uint64_t h = (uint64_t)addr;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+// Pick the shard from the high bits of a multiplicative hash, so the
+// choice is independent of the slot index within the shard
+static tracker_shard_t *shard_for(void *ptr) {
+    uint64_t mixed = ((uint64_t)(uintptr_t)ptr >> 3) * 0x9E3779B97F4A7C15ull;
+    return &tracker.shards[(mixed >> 40) & (tracker.shard_count - 1)];
+}
+
+static int slot_table_init(slot_table_t *table, size_t capacity) {
+    table_slot_t *slots = mmap(NULL, sizeof(table_slot_t) * capacity,
+                               PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (slots == MAP_FAILED) return -1;
+
+    table->slots = slots;
+    table->capacity = capacity;
+    table->count = 0;
+    return 0;
+}
+
+static void slot_table_destroy(slot_table_t *table) {
+    munmap(table->slots, sizeof(table_slot_t) * table->capacity);
+    table->slots = NULL;
+    table->capacity = 0;
+    table->count = 0;
+}
+
+// Probe for ptr; returns its slot index or -1
+static long slot_table_find(slot_table_t *table, uintptr_t ptr) {
+    size_t mask = table->capacity - 1;
+    size_t i = hash_ptr(ptr) & mask;
+
+    while (table->slots[i].ptr != SLOT_EMPTY) {
+        if (table->slots[i].ptr == ptr) return (long)i;
+        i = (i + 1) & mask;
+    }
+    return -1;
+}
+
+// Caller guarantees entry.ptr is absent and the table has a free slot
+static void slot_table_put(slot_table_t *table, table_slot_t entry) {
+    size_t mask = table->capacity - 1;
+    size_t i = hash_ptr(entry.ptr) & mask;
+
+    while (table->slots[i].ptr != SLOT_EMPTY) {
+        i = (i + 1) & mask;
+    }
+    table->slots[i] = entry;
+    table->count++;
+}
+
+// Backward-shift deletion: pull later members of the probe run into the
+// hole so lookups never need tombstones
+static void slot_table_erase(slot_table_t *table, size_t hole) {
+    size_t mask = table->capacity - 1;
+    size_t i = (hole + 1) & mask;
+
+    while (table->slots[i].ptr != SLOT_EMPTY) {
+        size_t home = hash_ptr(table->slots[i].ptr) & mask;
+        // Move the entry unless its home lies cyclically in (hole, i]
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            table->slots[hole] = table->slots[i];
+            hole = i;
+        }
+        i = (i + 1) & mask;
+    }
+    table->slots[hole].ptr = SLOT_EMPTY;
+    table->slots[hole].alloc = NULL;
+    table->count--;
+}
+
+// Move a bounded batch of entries out of the table being retired, so a
+// resize is spread over many operations instead of stalling one of them
+static void migrate_step(tracker_shard_t *shard, size_t batch) {
+    slot_table_t *old = &shard->old_table;
+    if (!old->slots) return;
+
+    // batch may be SIZE_MAX (migrate everything), so compare before adding
+    size_t end = batch > old->capacity - shard->migrate_pos ? old->capacity : shard->migrate_pos + batch;
+
+    for (size_t i = shard->migrate_pos; i < end; i++) {
+        uintptr_t ptr = old->slots[i].ptr;
+        if (ptr != SLOT_EMPTY && ptr != SLOT_TOMBSTONE) {
+            slot_table_put(&shard->table, old->slots[i]);
+            // Tombstone, not empty: later entries may have probed past it
+            old->slots[i].ptr = SLOT_TOMBSTONE;
+            old->count--;
+        }
+    }
+    shard->migrate_pos = end;
+
+    if (end == old->capacity) {
+        slot_table_destroy(old);
+    }
+}
+
+// Double the shard's table; existing entries migrate incrementally
+static void start_resize(tracker_shard_t *shard) {
+    slot_table_t bigger;
+
+    // Growth is far slower than migration, but finish any straggler
+    migrate_step(shard, SIZE_MAX);
+    if (slot_table_init(&bigger, shard->table.capacity * 2) != 0) return;
+
+    shard->old_table = shard->table;
+    shard->table = bigger;
+    shard->migrate_pos = 0;
+}
+
+// Allocate the shard array, sized from MEMTRACK_SHARDS or the core count
+static int init_shards(void) {
+    unsigned long wanted;
+    char *env = getenv("MEMTRACK_SHARDS");
+
+    if (env && *env) {
+        wanted = strtoul(env, NULL, 10);
+    } else {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        wanted = cpus > 0 ? (unsigned long)cpus * 4 : 4;
+    }
+
+    unsigned int count = 1;
+    while (count < wanted && count < MAX_SHARDS) {
+        count <<= 1;
+    }
+
+    // mmap keeps the table out of the heap we are tracking
+    tracker_shard_t *shards = mmap(NULL, sizeof(tracker_shard_t) * count,
+                                   PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (shards == MAP_FAILED) return -1;
+
+    for (unsigned int i = 0; i < count; i++) {
+        pthread_mutex_init(&shards[i].mutex, NULL);
+        if (slot_table_init(&shards[i].table, TABLE_INITIAL_CAPACITY) != 0) {
+            return -1;
+        }
+    }
+    tracker.shards = shards;
+    tracker.shard_count = count;
+    return 0;
+}
+
+static void lock_all_shards(void) {
+    for (unsigned int i = 0; i < tracker.shard_count; i++) {
+        pthread_mutex_lock(&tracker.shards[i].mutex);
+    }
+}
+
+static void unlock_all_shards(void) {
+    for (unsigned int i = tracker.shard_count; i > 0; i--) {
+        pthread_mutex_unlock(&tracker.shards[i - 1].mutex);
+    }
+}
+
+// Sum the per-shard counters, taking each shard lock in turn if lock is
+// set (otherwise the caller holds them all). Shards peak at different
+// times, so the peak comes from the batched process-wide counter instead.
+static void sum_shards(tracker_totals_t *totals, int lock) {
+    memset(totals, 0, sizeof(*totals));
+    for (unsigned int i = 0; i < tracker.shard_count; i++) {
+        tracker_shard_t *shard = &tracker.shards[i];
+        if (lock) pthread_mutex_lock(&shard->mutex);
+        totals->total_allocated += shard->total_allocated;
+        totals->total_freed += shard->total_freed;
+        totals->current_usage += shard->current_usage;
+        totals->allocation_count += shard->allocation_count;
+        totals->free_count += shard->free_count;
+        for (int c = 0; c < STATS_SIZE_CLASSES; c++) {
+            totals->live_by_class[c] += shard->live_by_class[c];
+            totals->allocs_by_class[c] += shard->allocs_by_class[c];
+        }
+        if (lock) pthread_mutex_unlock(&shard->mutex);
+    }
+    long peak = __atomic_load_n(&process_peak, __ATOMIC_RELAXED);
+    totals->peak_usage = peak > (long)totals->current_usage ? (size_t)peak : totals->current_usage;
+}
+
+static uint64_t hash_frames(void **frames, int depth) {
+    uint64_t h = 0xcbf29ce484222325ull ^ (uint64_t)depth;
+    for (int i = 0; i < depth; i++) {
+        h = (h ^ hash_ptr((uintptr_t)frames[i])) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+static stack_trace_t *stack_trace_get(uint32_t id) {
+    return &stack_table.chunks[id >> STACK_CHUNK_SHIFT][id & ((1u << STACK_CHUNK_SHIFT) - 1)];
+}
+
+// Lifetime histogram of a stack id, or NULL without MEMTRACK_LIFETIMES
+static lifetime_hist_t *lifetime_get(uint32_t id) {
+    lifetime_hist_t *hists = stack_table.lifetimes[id >> STACK_CHUNK_SHIFT];
+    return hists ? &hists[id & ((1u << STACK_CHUNK_SHIFT) - 1)] : NULL;
+}
+
+// realloc statistics of a stack id, or NULL without MEMTRACK_REALLOC
+static realloc_stats_t *realloc_stats_get(uint32_t id) {
+    realloc_stats_t *stats = stack_table.reallocs[id >> STACK_CHUNK_SHIFT];
+    return stats ? &stats[id & ((1u << STACK_CHUNK_SHIFT) - 1)] : NULL;
+}
+
+// Counters of a stack id, or NULL if callsite counters are not kept
+static callsite_t *callsite_get(uint32_t id) {
+    callsite_t *sites = stack_table.sites[id >> STACK_CHUNK_SHIFT];
+    return sites ? &sites[id & ((1u << STACK_CHUNK_SHIFT) - 1)] : NULL;
+}
+
+// Map the storage behind a chunk of stack ids (caller holds stack_table.lock)
+static int map_stack_chunk(unsigned int chunk) {
+    if (stack_table.chunks[chunk]) return 0;
+
+    if (aggregate_mode || snapshot_interval) {
+        void *sites = mmap(NULL, sizeof(callsite_t) << STACK_CHUNK_SHIFT,
+                           PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (sites == MAP_FAILED) return -1;
+        stack_table.sites[chunk] = sites;
+    }
+    if (lifetime_mode) {
+        void *hists = mmap(NULL, sizeof(lifetime_hist_t) << STACK_CHUNK_SHIFT,
+                           PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (hists == MAP_FAILED) return -1;
+        stack_table.lifetimes[chunk] = hists;
+    }
+    if (realloc_mode) {
+        void *stats = mmap(NULL, sizeof(realloc_stats_t) << STACK_CHUNK_SHIFT,
+                           PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (stats == MAP_FAILED) return -1;
+        stack_table.reallocs[chunk] = stats;
+    }
+
+    void *mem = mmap(NULL, sizeof(stack_trace_t) << STACK_CHUNK_SHIFT,
+                     PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) return -1;
+    stack_table.chunks[chunk] = mem;
+    return 0;
+}
+
+static stack_index_t *stack_index_create(size_t capacity) {
+    size_t bytes = sizeof(stack_index_t) + sizeof(uint32_t) * capacity;
+    stack_index_t *index = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (index == MAP_FAILED) return NULL;
+
+    index->slots = (uint32_t *)(index + 1);
+    index->capacity = capacity;
+    return index;
+}
+
+// Probe an index for a trace; returns its id or 0
+static uint32_t stack_index_find(stack_index_t *index, uint64_t hash,
+                                 void **frames, int depth) {
+    size_t mask = index->capacity - 1;
+
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        uint32_t id = __atomic_load_n(&index->slots[i], __ATOMIC_ACQUIRE);
+        if (id == 0) return 0;
+
+        stack_trace_t *trace = stack_trace_get(id);
+        if (trace->hash == hash && trace->depth == (uint32_t)depth &&
+            memcmp(trace->frames, frames, sizeof(void *) * depth) == 0) {
+            return id;
+        }
+    }
+}
+
+static void stack_index_put(stack_index_t *index, uint64_t hash, uint32_t id) {
+    size_t mask = index->capacity - 1;
+    size_t i = hash & mask;
+
+    while (index->slots[i] != 0) {
+        i = (i + 1) & mask;
+    }
+    __atomic_store_n(&index->slots[i], id, __ATOMIC_RELEASE);
+}
+
+// Return the id of a trace, adding it to the table if it is new.
+// Returns 0 if the table is full.
+static uint32_t intern_stack(void **frames, int depth) {
+    if (depth <= 0) return 0;
+
+    uint64_t hash = hash_frames(frames, depth);
+    stack_index_t *index = __atomic_load_n(&stack_table.index, __ATOMIC_ACQUIRE);
+    uint32_t id = index ? stack_index_find(index, hash, frames, depth) : 0;
+    if (id) return id;
+
+    pthread_mutex_lock(&stack_table.lock);
+
+    // Re-check against the current index: another thread may have added
+    // the trace, or grown the index, since the unlocked probe
+    index = stack_table.index;
+    if (!index) {
+        index = stack_index_create(STACK_INDEX_INITIAL);
+        __atomic_store_n(&stack_table.index, index, __ATOMIC_RELEASE);
+    }
+    if (index && !(id = stack_index_find(index, hash, frames, depth))) {
+        id = stack_table.count;
+        unsigned int chunk = id >> STACK_CHUNK_SHIFT;
+
+        if (chunk >= STACK_MAX_CHUNKS || map_stack_chunk(chunk) != 0) {
+            id = 0;
+        }
+    }
+
+    if (id && id == stack_table.count) {
+        stack_trace_t *trace = stack_trace_get(id);
+        trace->hash = hash;
+        trace->depth = depth;
+        memcpy(trace->frames, frames, sizeof(void *) * depth);
+        stack_table.count++;
+
+        // Keep the load under 70%. The old index is left mapped because
+        // lock-free readers may still be probing it.
+        if ((size_t)stack_table.count * 10 > index->capacity * 7) {
+            stack_index_t *bigger = stack_index_create(index->capacity * 2);
+            if (bigger) {
+                for (uint32_t i = 1; i < id; i++) {
+                    stack_index_put(bigger, stack_trace_get(i)->hash, i);
+                }
+                index = bigger;
+                __atomic_store_n(&stack_table.index, bigger, __ATOMIC_RELEASE);
+            }
+        }
+        stack_index_put(index, hash, id);
+    }
+
+    pthread_mutex_unlock(&stack_table.lock);
+    return id;
+}
+
+// Cache the calling thread's stack bounds, used to validate unwinding
+static int thread_stack_bounds(void) {
+    if (thread_stack_high) return 1;
+
+    pthread_attr_t attr;
+    void *addr;
+    size_t size;
+
+    if (pthread_getattr_np(pthread_self(), &attr) != 0) return 0;
+    int ok = pthread_attr_getstack(&attr, &addr, &size) == 0;
+    pthread_attr_destroy(&attr);
+    if (!ok) return 0;
+
+    thread_stack_low = (uintptr_t)addr;
+    thread_stack_high = (uintptr_t)addr + size;
+    return 1;
+}
+
+// List the calling thread's stack and TLS as reachability roots (caller
+// sets in_tracker). glibc's pthread_self() is the thread pointer.
+static void reach_register_thread(void) {
+    thread_reach = &reach_unregistered;
+    if (thread_exiting || !thread_stack_bounds()) return;
+
+    for (int i = 0; i < REACH_MAX_THREADS; i++) {
+        reach_thread_t *entry = &reach_threads[i];
+        int expected = 0;
+        if (!__atomic_load_n(&entry->used, __ATOMIC_RELAXED) &&
+            __atomic_compare_exchange_n(&entry->used, &expected, -1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            entry->stack_low = thread_stack_low;
+            entry->stack_high = thread_stack_high;
+            entry->thread_pointer = (uintptr_t)pthread_self();
+            __atomic_store_n(&entry->used, 1, __ATOMIC_RELEASE);
+            thread_reach = entry;
+            register_thread();
+            return;
+        }
+    }
+    __atomic_add_fetch(&reach_threads_missed, 1, __ATOMIC_RELAXED);
+}
+
+// Walk the saved frame-pointer chain. Only reliable through code built
+// with -fno-omit-frame-pointer; stops at the first frame that leaves the
+// thread's stack or does not move towards its base.
+__attribute__((noinline))
+static int unwind_frame_pointers(void **frames, int max) {
+    if (!thread_stack_bounds()) return 0;
+
+    uintptr_t *fp = __builtin_frame_address(0);
+    int depth = 0;
+
+    while (depth < max) {
+        uintptr_t addr = (uintptr_t)fp;
+        if (addr < thread_stack_low || addr + 2 * sizeof(void *) > thread_stack_high ||
+            (addr & (sizeof(void *) - 1))) {
+            break;
+        }
+        if (!fp[1]) break;
+        frames[depth++] = (void *)fp[1];
+
+        uintptr_t *next = (uintptr_t *)fp[0];
+        if (next <= fp) break;
+        fp = next;
+    }
+    return depth;
+}
+
+#if defined(__x86_64__)
+
+#define DWARF_REG_RBP 6
+#define DWARF_REG_RSP 7
+#define DWARF_REG_RA 16
+
+// Provided by libgcc_s; finds the FDE covering pc
+struct dwarf_eh_bases {
+    void *tbase;
+    void *dbase;
+    void *func;
+};
+static const void *(*find_fde)(void *pc, struct dwarf_eh_bases *bases) = NULL;
+
+// Register rules we care about while running a CFA program
+typedef struct {
+    int cfa_reg;
+    intptr_t cfa_offset;
+    intptr_t rbp_offset;    // 0 = same value
+    intptr_t ra_offset;
+} cfi_state_t;
+
+static uintptr_t read_uleb(const uint8_t **p) {
+    uintptr_t result = 0;
+    unsigned int shift = 0;
+    uint8_t byte;
+
+    do {
+        byte = *(*p)++;
+        if (shift < 64) result |= (uintptr_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return result;
+}
+
+static intptr_t read_sleb(const uint8_t **p) {
+    uintptr_t result = 0;
+    unsigned int shift = 0;
+    uint8_t byte;
+
+    do {
+        byte = *(*p)++;
+        if (shift < 64) result |= (uintptr_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    if (shift < 64 && (byte & 0x40)) result |= ~(uintptr_t)0 << shift;
+    return (intptr_t)result;
+}
+
+// Skip a DW_EH_PE encoded value
+static int skip_encoded(const uint8_t **p, uint8_t encoding) {
+    if (encoding == 0xff) return 0;     // DW_EH_PE_omit
+
+    switch (encoding & 0x0f) {
+    case 0x00: *p += sizeof(void *); break;
+    case 0x01: case 0x09: read_uleb(p); break;
+    case 0x02: case 0x0a: *p += 2; break;
+    case 0x03: case 0x0b: *p += 4; break;
+    case 0x04: case 0x0c: *p += 8; break;
+    default: return -1;
+    }
+    return 0;
+}
+
+// Run CFA instructions from loc until the row covering target. Returns -1
+// for instructions that move the CFA, rbp or the return address somewhere
+// this unwinder cannot follow.
+static int run_cfa_program(const uint8_t *p, const uint8_t *end, uintptr_t loc,
+                           uintptr_t target, uintptr_t code_align, intptr_t data_align,
+                           cfi_state_t *state, const cfi_state_t *initial) {
+    cfi_state_t saved[CFI_STATE_STACK];
+    int saved_count = 0;
+
+    while (p < end) {
+        uint8_t op = *p++;
+        uintptr_t reg;
+        intptr_t offset;
+
+        switch (op & 0xc0) {
+        case 0x40:      // DW_CFA_advance_loc
+            loc += (op & 0x3f) * code_align;
+            if (loc > target) return 0;
+            continue;
+        case 0x80:      // DW_CFA_offset
+            offset = (intptr_t)read_uleb(&p) * data_align;
+            if ((op & 0x3f) == DWARF_REG_RBP) state->rbp_offset = offset;
+            if ((op & 0x3f) == DWARF_REG_RA) state->ra_offset = offset;
+            continue;
+        case 0xc0:      // DW_CFA_restore
+            if ((op & 0x3f) == DWARF_REG_RBP) state->rbp_offset = initial->rbp_offset;
+            if ((op & 0x3f) == DWARF_REG_RA) state->ra_offset = initial->ra_offset;
+            continue;
+        }
+
+        switch (op) {
+        case 0x00:      // DW_CFA_nop
+            break;
+        case 0x02:      // DW_CFA_advance_loc1
+            loc += *p++ * code_align;
+            if (loc > target) return 0;
+            break;
+        case 0x03:      // DW_CFA_advance_loc2
+            loc += (p[0] | (p[1] << 8)) * code_align;
+            p += 2;
+            if (loc > target) return 0;
+            break;
+        case 0x04:      // DW_CFA_advance_loc4
+            loc += ((uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+                    ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24)) * code_align;
+            p += 4;
+            if (loc > target) return 0;
+            break;
+        case 0x05:      // DW_CFA_offset_extended
+        case 0x11:      // DW_CFA_offset_extended_sf
+            reg = read_uleb(&p);
+            offset = (op == 0x05 ? (intptr_t)read_uleb(&p) : read_sleb(&p)) * data_align;
+            if (reg == DWARF_REG_RBP) state->rbp_offset = offset;
+            if (reg == DWARF_REG_RA) state->ra_offset = offset;
+            break;
+        case 0x06:      // DW_CFA_restore_extended
+            reg = read_uleb(&p);
+            if (reg == DWARF_REG_RBP) state->rbp_offset = initial->rbp_offset;
+            if (reg == DWARF_REG_RA) state->ra_offset = initial->ra_offset;
+            break;
+        case 0x07:      // DW_CFA_undefined
+        case 0x08:      // DW_CFA_same_value
+            reg = read_uleb(&p);
+            if (reg == DWARF_REG_RBP) state->rbp_offset = 0;
+            if (reg == DWARF_REG_RA) return -1;
+            break;
+        case 0x09:      // DW_CFA_register
+            reg = read_uleb(&p);
+            read_uleb(&p);
+            if (reg == DWARF_REG_RBP || reg == DWARF_REG_RA) return -1;
+            break;
+        case 0x0a:      // DW_CFA_remember_state
+            if (saved_count == CFI_STATE_STACK) return -1;
+            saved[saved_count++] = *state;
+            break;
+        case 0x0b:      // DW_CFA_restore_state
+            if (saved_count == 0) return -1;
+            *state = saved[--saved_count];
+            break;
+        case 0x0c:      // DW_CFA_def_cfa
+            state->cfa_reg = (int)read_uleb(&p);
+            state->cfa_offset = (intptr_t)read_uleb(&p);
+            break;
+        case 0x12:      // DW_CFA_def_cfa_sf
+            state->cfa_reg = (int)read_uleb(&p);
+            state->cfa_offset = read_sleb(&p) * data_align;
+            break;
+        case 0x0d:      // DW_CFA_def_cfa_register
+            state->cfa_reg = (int)read_uleb(&p);
+            break;
+        case 0x0e:      // DW_CFA_def_cfa_offset
+            state->cfa_offset = (intptr_t)read_uleb(&p);
+            break;
+        case 0x13:      // DW_CFA_def_cfa_offset_sf
+            state->cfa_offset = read_sleb(&p) * data_align;
+            break;
+        case 0x10:      // DW_CFA_expression
+        case 0x16:      // DW_CFA_val_expression
+            reg = read_uleb(&p);
+            if (reg == DWARF_REG_RBP || reg == DWARF_REG_RA) return -1;
+            p += read_uleb(&p);
+            break;
+        case 0x14:      // DW_CFA_val_offset
+            reg = read_uleb(&p);
+            read_uleb(&p);
+            if (reg == DWARF_REG_RBP || reg == DWARF_REG_RA) return -1;
+            break;
+        case 0x15:      // DW_CFA_val_offset_sf
+            reg = read_uleb(&p);
+            read_sleb(&p);
+            if (reg == DWARF_REG_RBP || reg == DWARF_REG_RA) return -1;
+            break;
+        case 0x2e:      // DW_CFA_GNU_args_size
+            read_uleb(&p);
+            break;
+        default:        // DW_CFA_set_loc, DW_CFA_def_cfa_expression, ...
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Derive the unwind rule for pc from its FDE
+static int compute_cfi_rule(uintptr_t pc, cfi_rule_t *rule) {
+    struct dwarf_eh_bases bases;
+    const uint8_t *fde = find_fde ? find_fde((void *)pc, &bases) : NULL;
+    if (!fde) return -1;
+
+    uint32_t fde_length;
+    int32_t cie_offset;
+    memcpy(&fde_length, fde, 4);
+    memcpy(&cie_offset, fde + 4, 4);
+    if (fde_length == 0xffffffff) return -1;
+
+    const uint8_t *cie = fde + 4 - cie_offset;
+    uint32_t cie_length;
+    memcpy(&cie_length, cie, 4);
+    if (cie_length == 0xffffffff) return -1;
+
+    // CIE: version, augmentation, alignment factors, return register
+    const uint8_t *p = cie + 8;
+    const uint8_t *cie_end = cie + 4 + cie_length;
+    uint8_t version = *p++;
+    const char *augmentation = (const char *)p;
+    p += strlen(augmentation) + 1;
+    if (version >= 4) p += 2;
+    uintptr_t code_align = read_uleb(&p);
+    intptr_t data_align = read_sleb(&p);
+    if (version == 1) p++;
+    else read_uleb(&p);
+
+    uint8_t fde_encoding = 0;
+    if (augmentation[0] == 'z') {
+        uintptr_t length = read_uleb(&p);
+        const uint8_t *aug_end = p + length;
+        for (const char *a = augmentation + 1; *a; a++) {
+            if (*a == 'R') {
+                fde_encoding = *p++;
+            } else if (*a == 'P') {
+                uint8_t encoding = *p++;
+                if (skip_encoded(&p, encoding) != 0) return -1;
+            } else if (*a == 'L') {
+                p++;
+            } else if (*a == 'S') {
+                return -1;      // Signal frame
+            }
+        }
+        p = aug_end;
+    } else if (augmentation[0]) {
+        return -1;
+    }
+
+    cfi_state_t initial = { DWARF_REG_RSP, 8, 0, -8 };
+    if (run_cfa_program(p, cie_end, 0, 0, code_align, data_align, &initial, &initial) != 0) {
+        return -1;
+    }
+
+    // FDE: skip pc_begin/pc_range (bases.func already has the start)
+    p = fde + 8;
+    if (skip_encoded(&p, fde_encoding) != 0 || skip_encoded(&p, fde_encoding & 0x0f) != 0) {
+        return -1;
+    }
+    if (augmentation[0] == 'z') {
+        uintptr_t length = read_uleb(&p);
+        p += length;
+    }
+
+    cfi_state_t state = initial;
+    if (run_cfa_program(p, fde + 4 + fde_length, (uintptr_t)bases.func, pc,
+                        code_align, data_align, &state, &initial) != 0) {
+        return -1;
+    }
+    if ((state.cfa_reg != DWARF_REG_RSP && state.cfa_reg != DWARF_REG_RBP) ||
+        state.ra_offset != -8) {
+        return -1;
+    }
+
+    rule->cfa_reg = (uint8_t)state.cfa_reg;
+    rule->cfa_offset = (int32_t)state.cfa_offset;
+    rule->rbp_offset = (int16_t)state.rbp_offset;
+    return 0;
+}
+
+// Memoized rule for a return address (per-thread direct-mapped cache)
+static cfi_rule_t *lookup_cfi_rule(uintptr_t pc, cfi_rule_t *scratch) {
+    cfi_rule_t *entry = scratch;
+
+    if (!thread_cfi_cache && !thread_exiting) {
+        void *cache = mmap(NULL, sizeof(cfi_rule_t) * CFI_CACHE_SIZE, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (cache != MAP_FAILED) thread_cfi_cache = cache;
+    }
+    if (thread_cfi_cache) {
+        entry = &thread_cfi_cache[hash_ptr(pc) & (CFI_CACHE_SIZE - 1)];
+        if (entry->pc == pc) {
+            return entry->usable ? entry : NULL;
+        }
+    }
+
+    entry->pc = pc;
+    // Look up pc - 1: a return address may be the first byte of the next
+    // function when the call was the last instruction
+    entry->usable = compute_cfi_rule(pc - 1, entry) == 0;
+    return entry->usable ? entry : NULL;
+}
+
+// Unwind with .eh_frame rules. Starts from this function's own frame,
+// which always has a frame pointer because it takes its address.
+__attribute__((noinline))
+static int unwind_cfi(void **frames, int max) {
+    if (!find_fde || !thread_stack_bounds()) return -1;
+
+    uintptr_t *fp = __builtin_frame_address(0);
+    uintptr_t pc = fp[1];
+    uintptr_t rsp = (uintptr_t)(fp + 2);
+    uintptr_t rbp = fp[0];
+    int depth = 0;
+
+    while (depth < max && pc) {
+        frames[depth++] = (void *)pc;
+
+        cfi_rule_t scratch;
+        cfi_rule_t *rule = lookup_cfi_rule(pc, &scratch);
+        if (!rule) break;
+
+        uintptr_t cfa = (rule->cfa_reg == DWARF_REG_RSP ? rsp : rbp) + rule->cfa_offset;
+        if (cfa <= rsp || cfa > thread_stack_high) break;
+
+        if (rule->rbp_offset) {
+            rbp = *(uintptr_t *)(cfa + rule->rbp_offset);
+        }
+        pc = *(uintptr_t *)(cfa - 8);
+        rsp = cfa;
+    }
+    return depth;
+}
+
+// Unwind an interrupted thread from its signal context, for the guard
+// fault handler: nothing is looked up, mapped or locked. Frames step by the
+// CFI rules this thread already memoized, by frame pointer otherwise, and
+// only within stack bounds found before the fault.
+static int unwind_context(void *context, void **frames, int max) {
+    greg_t *regs = ((ucontext_t *)context)->uc_mcontext.gregs;
+    uintptr_t pc = regs[REG_RIP];
+    uintptr_t rsp = regs[REG_RSP];
+    uintptr_t rbp = regs[REG_RBP];
+    int depth = 0;
+
+    while (depth < max && pc) {
+        frames[depth++] = (void *)pc;
+        if (!thread_stack_high) break;
+
+        cfi_rule_t *rule = thread_cfi_cache ? &thread_cfi_cache[hash_ptr(pc) & (CFI_CACHE_SIZE - 1)] : NULL;
+        uintptr_t cfa;
+        if (unwind_mode == UNWIND_CFI && rule && rule->pc == pc && rule->usable) {
+            cfa = (rule->cfa_reg == DWARF_REG_RSP ? rsp : rbp) + rule->cfa_offset;
+            if (cfa <= rsp || cfa > thread_stack_high) break;
+            if (rule->rbp_offset) {
+                rbp = *(uintptr_t *)(cfa + rule->rbp_offset);
+            }
+        } else {
+            if (rbp < rsp || rbp < thread_stack_low || rbp + 16 > thread_stack_high || (rbp & 7)) break;
+            cfa = rbp + 16;
+            rbp = *(uintptr_t *)rbp;
+        }
+        pc = *(uintptr_t *)(cfa - 8);
+        rsp = cfa;
+    }
+    return depth;
+}
+
+// Resolve the FDE lookup from libgcc_s, loading it if nothing has yet
+static void init_cfi_unwinder(void) {
+    find_fde = dlsym(RTLD_DEFAULT, "_Unwind_Find_FDE");
+    if (!find_fde) {
+        void *libgcc = dlopen("libgcc_s.so.1", RTLD_NOW);
+        if (libgcc) find_fde = dlsym(libgcc, "_Unwind_Find_FDE");
+    }
+    if (!find_fde) {
+        fprintf(stderr, "Memory Tracker: _Unwind_Find_FDE unavailable, using frame pointers\n");
+        unwind_mode = UNWIND_FP;
+    }
+}
+
+#else
+
+static int unwind_cfi(void **frames, int max) {
+    return unwind_frame_pointers(frames, max);
+}
+
+// Without the register layout, walk from the handler's own frame
+static int unwind_context(void *context, void **frames, int max) {
+    (void)context;
+    return thread_stack_high ? unwind_frame_pointers(frames, max) : 0;
+}
+
+static void init_cfi_unwinder(void) {
+    fprintf(stderr, "Memory Tracker: CFI unwinder is x86-64 only, using frame pointers\n");
+    unwind_mode = UNWIND_FP;
+}
+
+#endif
+
+// Find the executable segment holding the tracker's own code
+static int find_self_text(struct dl_phdr_info *info, size_t size, void *data) {
+    (void)size;
+    (void)data;
+    uintptr_t self = (uintptr_t)find_self_text;
+
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+        uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+        if (phdr->p_type == PT_LOAD && (phdr->p_flags & PF_X) &&
+            self >= start && self < start + phdr->p_memsz) {
+            self_text_start = start;
+            self_text_end = start + phdr->p_memsz;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Capture and intern the calling thread's stack. The tracker's own frames
+// on top (capture_stack, the recording helper, the interposed entry point)
+// are dropped, so stacks start at the caller and keep every slot for it.
+static uint32_t capture_stack(void) {
+    void *frames[MAX_BACKTRACE + TRACKER_FRAMES_MAX];
+    int depth = -1;
+
+    if (unwind_mode == UNWIND_FP) {
+        depth = unwind_frame_pointers(frames, MAX_BACKTRACE + TRACKER_FRAMES_MAX);
+    } else if (unwind_mode == UNWIND_CFI) {
+        depth = unwind_cfi(frames, MAX_BACKTRACE + TRACKER_FRAMES_MAX);
+    }
+    if (depth < 0) {
+        depth = backtrace(frames, MAX_BACKTRACE + TRACKER_FRAMES_MAX);
+    }
+
+    int skip = 0;
+    while (skip < depth && (uintptr_t)frames[skip] - self_text_start < self_text_end - self_text_start) {
+        skip++;
+    }
+    if (depth - skip > MAX_BACKTRACE) depth = skip + MAX_BACKTRACE;
+    return intern_stack(frames + skip, depth - skip);
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Size class of a request for the stats page: class c holds [2^(c-1), 2^c)
+static unsigned int stats_size_class(size_t size) {
+    unsigned int size_class = size ? 64 - __builtin_clzll(size) : 0;
+    return size_class < STATS_SIZE_CLASSES ? size_class : STATS_SIZE_CLASSES - 1;
+}
+
+// Histogram bucket of a lifetime: bucket b holds [2^(b-1), 2^b) ns
+static unsigned int lifetime_bucket(uint64_t ns) {
+    unsigned int bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+    return bucket < LIFETIME_BUCKETS ? bucket : LIFETIME_BUCKETS - 1;
+}
+
+// xorshift64* step on a per-thread state, seeded on first use
+static uint64_t random_next(uint64_t *state) {
+    if (*state == 0) {
+        *state = hash_ptr((uintptr_t)state ^ monotonic_ns()) | 1;
+    }
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1Dull;
+}
+
+// Draw the byte distance to the next sample from an exponential
+// distribution, which makes sampling a Poisson process over bytes
+static int64_t next_sample_distance(void) {
+    double u = (double)((random_next(&sample_rng) >> 11) + 1) / 9007199254740992.0;
+    return (int64_t)(-log(u) * sample_interval) + 1;
+}
+
+// Decide whether an allocation is sampled. An allocation of size s is
+// picked with probability 1 - exp(-s / sample_interval).
+static int sample_allocation(size_t size) {
+    bytes_until_sample -= (int64_t)size;
+    if (bytes_until_sample > 0) return 0;
+
+    if (sample_rng == 0) {
+        // First allocation on this thread: start from a fresh draw
+        bytes_until_sample = next_sample_distance() - (int64_t)size;
+        if (bytes_until_sample > 0) return 0;
+    }
+    bytes_until_sample = next_sample_distance();
+    return 1;
+}
+
+// Unbiased estimate of the bytes/allocations one sampled block stands for
+static double sample_scale(size_t size) {
+    if (!sample_interval || size == 0) return 1.0;
+    return 1.0 / -expm1(-(double)size / sample_interval);
+}
+
+static size_t estimated_bytes(size_t size) {
+    return sample_interval ? (size_t)llround((double)size * sample_scale(size)) : size;
+}
+
+static size_t estimated_count(size_t size) {
+    return sample_interval ? (size_t)llround(sample_scale(size)) : 1;
+}
+
+// Index of the calling thread for the thread-pair table, assigned on first use
+static uint16_t current_thread_index(void) {
+    if (!thread_index) {
+        uint32_t index = __atomic_add_fetch(&thread_index_count, 1, __ATOMIC_RELAXED);
+        if (!thread_tid) thread_tid = (uint32_t)syscall(SYS_gettid);
+        if (index < THREAD_INDEX_OVERFLOW) {
+            thread_index_tids[index] = thread_tid;
+        } else {
+            index = THREAD_INDEX_OVERFLOW;
+        }
+        thread_index = (uint16_t)index;
+    }
+    return thread_index;
+}
+
+// Count a free in the thread-pair table, claiming a slot for a new
+// (allocating thread, freeing thread, stack) key with a CAS
+static void count_thread_free(uint16_t alloc_thread, uint16_t free_thread,
+                              uint32_t stack_id, size_t size) {
+    uint64_t key = (uint64_t)alloc_thread << 48 | (uint64_t)free_thread << 32 | stack_id;
+    size_t mask = THREAD_PAIR_SLOTS - 1;
+    size_t i = hash_ptr(key) & mask;
+
+    for (size_t probes = 0; probes < THREAD_PAIR_SLOTS; probes++, i = (i + 1) & mask) {
+        thread_pair_t *pair = &thread_pairs[i];
+        uint64_t current = __atomic_load_n(&pair->key, __ATOMIC_ACQUIRE);
+        if (current == 0) {
+            uint64_t empty = 0;
+            if (__atomic_compare_exchange_n(&pair->key, &empty, key, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                current = key;
+            } else {
+                current = empty;
+            }
+        }
+        if (current == key) {
+            __atomic_add_fetch(&pair->blocks, estimated_count(size), __ATOMIC_RELAXED);
+            __atomic_add_fetch(&pair->bytes, estimated_bytes(size), __ATOMIC_RELAXED);
+            return;
+        }
+    }
+    __atomic_add_fetch(&thread_pairs_dropped, 1, __ATOMIC_RELAXED);
+}
+
+static uint8_t *sample_filter_slot(void *ptr) {
+    return &sample_filter[hash_ptr((uintptr_t)ptr) >> (64 - SAMPLE_FILTER_BITS)];
+}
+
+// Counters saturate at 255 and then stay put
+static void sample_filter_add(void *ptr) {
+    uint8_t *slot = sample_filter_slot(ptr);
+    uint8_t count = __atomic_load_n(slot, __ATOMIC_RELAXED);
+    while (count < 255 &&
+           !__atomic_compare_exchange_n(slot, &count, count + 1, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static void sample_filter_remove(void *ptr) {
+    uint8_t *slot = sample_filter_slot(ptr);
+    uint8_t count = __atomic_load_n(slot, __ATOMIC_RELAXED);
+    while (count > 0 && count < 255 &&
+           !__atomic_compare_exchange_n(slot, &count, count - 1, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static int sample_filter_contains(void *ptr) {
+    return __atomic_load_n(sample_filter_slot(ptr), __ATOMIC_RELAXED) != 0;
+}
+
+// With sampling on, most frees of unknown pointers are filter false
+// positives, and after tracking is switched back on they are blocks from
+// before the window, so only warn when every allocation is tracked
+static void warn_untracked_free(void *ptr) {
+    if (!sample_interval && !__atomic_load_n(&tracking_restarted, __ATOMIC_RELAXED)) {
+        fprintf(stderr, "Memory Tracker: WARNING - Free of untracked pointer %p\n", ptr);
+    }
+}
+
+// Initialize the tracker
+#define TRACE_CHUNK_BYTES (sizeof(trace_record_t) * TRACE_CHUNK_RECORDS)
+
+// Create the trace file and map its header page
+static void init_trace(const char *path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Memory Tracker: Cannot open trace file %s\n", path);
+        return;
+    }
+
+    trace_header_t *header = MAP_FAILED;
+    if (ftruncate(fd, TRACE_HEADER_SIZE) == 0) {
+        header = mmap(NULL, TRACE_HEADER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (header == MAP_FAILED) {
+        fprintf(stderr, "Memory Tracker: Cannot map trace file %s\n", path);
+        close(fd);
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    memcpy(header->magic, TRACE_MAGIC, sizeof(header->magic));
+    header->version = TRACE_VERSION;
+    header->record_size = sizeof(trace_record_t);
+    header->chunk_records = TRACE_CHUNK_RECORDS;
+    header->max_frames = MAX_BACKTRACE;
+    header->pid = getpid();
+    header->start_clock_ns = monotonic_ns();
+    header->start_realtime_ns = (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+
+    trace_header = header;
+    trace_fd = fd;
+}
+
+// Map a chunk for the calling thread, reusing one left by an exited thread
+// if possible. Returns -1 once the trace is closed or the file cannot grow.
+static int trace_acquire_chunk(void) {
+    uint64_t index;
+    uint32_t used = 0;
+
+    pthread_mutex_lock(&trace_lock);
+    if (trace_closed) {
+        pthread_mutex_unlock(&trace_lock);
+        return -1;
+    }
+    if (trace_spare_count > 0) {
+        trace_spare_count--;
+        index = trace_spares[trace_spare_count].index;
+        used = trace_spares[trace_spare_count].used;
+    } else {
+        index = trace_header->chunk_count;
+        if (ftruncate(trace_fd, TRACE_HEADER_SIZE + (index + 1) * TRACE_CHUNK_BYTES) != 0) {
+            pthread_mutex_unlock(&trace_lock);
+            return -1;
+        }
+        trace_header->chunk_count = index + 1;
+    }
+    pthread_mutex_unlock(&trace_lock);
+
+    trace_record_t *chunk = mmap(NULL, TRACE_CHUNK_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED,
+                                 trace_fd, TRACE_HEADER_SIZE + index * TRACE_CHUNK_BYTES);
+    if (chunk == MAP_FAILED) return -1;
+
+    thread_trace_chunk = index;
+    trace_pos = chunk + used;
+    trace_end = chunk + TRACE_CHUNK_RECORDS;
+    return 0;
+}
+
+// Unmap the calling thread's chunk, keeping it for reuse if it has room
+static void trace_release_chunk(void) {
+    if (!trace_end) return;
+
+    trace_record_t *chunk = trace_end - TRACE_CHUNK_RECORDS;
+    uint32_t used = (uint32_t)(trace_pos - chunk);
+
+    pthread_mutex_lock(&trace_lock);
+    if (used < TRACE_CHUNK_RECORDS && trace_spare_count < TRACE_SPARE_CHUNKS) {
+        trace_spares[trace_spare_count].index = thread_trace_chunk;
+        trace_spares[trace_spare_count].used = used;
+        trace_spare_count++;
+    }
+    pthread_mutex_unlock(&trace_lock);
+
+    munmap(chunk, TRACE_CHUNK_BYTES);
+    trace_pos = trace_end = NULL;
+}
+
+// Append one record to the calling thread's chunk
+static void trace_event(int type, int api, void *ptr, void *old_ptr, size_t size, uint32_t stack_id) {
+    if (trace_pos == trace_end && (trace_release_chunk(), trace_acquire_chunk() != 0)) return;
+
+    if (!thread_tid) thread_tid = (uint32_t)syscall(SYS_gettid);
+
+    trace_record_t *record = trace_pos++;
+    record->clock_ns = monotonic_ns();
+    record->ptr = (uintptr_t)ptr;
+    record->old_ptr = (uintptr_t)old_ptr;
+    record->size = size;
+    record->tid = thread_tid;
+    record->stack_id = stack_id;
+    record->type = type;
+    record->api = api;
+
+    if (thread_exiting) {
+        // Past release_thread_state: do not keep a mapping around
+        trace_release_chunk();
+    }
+}
+
+// Append the stack table and /proc/self/maps after the last chunk and stop
+// handing out chunks. Threads keep writing into chunks they already hold.
+static void finish_trace(void) {
+    pthread_mutex_lock(&trace_lock);
+    trace_closed = 1;
+    pthread_mutex_unlock(&trace_lock);
+
+    off_t offset = TRACE_HEADER_SIZE + trace_header->chunk_count * TRACE_CHUNK_BYTES;
+    uint32_t stack_count = __atomic_load_n(&stack_table.count, __ATOMIC_ACQUIRE);
+    trace_header->stacks_offset = offset;
+
+    for (uint32_t id = 0; id < stack_count; id++) {
+        trace_stack_t entry;
+        memset(&entry, 0, sizeof(entry));
+        if (id > 0) {
+            stack_trace_t *trace = stack_trace_get(id);
+            entry.depth = trace->depth;
+            for (uint32_t i = 0; i < trace->depth; i++) {
+                entry.frames[i] = (uintptr_t)trace->frames[i];
+            }
+        }
+        if (pwrite(trace_fd, &entry, sizeof(entry), offset) != (ssize_t)sizeof(entry)) break;
+        offset += sizeof(entry);
+        trace_header->stack_count = id + 1;
+    }
+
+    trace_header->maps_offset = offset;
+    int maps = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if (maps >= 0) {
+        char buffer[4096];
+        ssize_t n;
+        while ((n = read(maps, buffer, sizeof(buffer))) > 0) {
+            if (pwrite(trace_fd, buffer, n, offset) != n) break;
+            offset += n;
+        }
+        close(maps);
+    }
+    trace_header->maps_size = offset - trace_header->maps_offset;
+    msync(trace_header, TRACE_HEADER_SIZE, MS_ASYNC);
+}
+
+// Report a block released through the wrong family, e.g. new[] + free()
+static void check_dealloc(void *ptr, int api, int dealloc) {
+    if (api >= 0 && dealloc >= 0 && api_dealloc[api] != dealloc) {
+        fprintf(stderr, "Memory Tracker: WARNING - %p allocated with %s released with %s\n",
+                ptr, api_names[api], dealloc_names[dealloc]);
+    }
+}
+
+// Create the counters page. Monitors map the file read-only and poll it;
+// the header is filled in before the magic so a half-built page never
+// looks valid. A file already at the path is left over from a process that
+// died without cleaning up (or is not ours), so it is removed and a fresh
+// one created exclusively, never through a symlink.
+static void init_stats(const char *path) {
+    if (path) {
+        snprintf(stats_path, sizeof(stats_path), "%s", path);
+    } else {
+        snprintf(stats_path, sizeof(stats_path), "/dev/shm/memtrack.%d", getpid());
+    }
+
+    unlink(stats_path);
+    int fd = open(stats_path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Memory Tracker: Cannot open stats file %s\n", stats_path);
+        return;
+    }
+    stats_page_t *page = MAP_FAILED;
+    if (ftruncate(fd, STATS_PAGE_SIZE) == 0) {
+        page = mmap(NULL, STATS_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (page == MAP_FAILED) {
+        fprintf(stderr, "Memory Tracker: Cannot map stats file %s\n", stats_path);
+        unlink(stats_path);
+        return;
+    }
+
+    char *env = getenv("MEMTRACK_STATS_INTERVAL_MS");
+    if (env && *env && atol(env) > 0) {
+        stats_interval_ms = atol(env);
+    }
+
+    page->version = STATS_VERSION;
+    page->size_classes = STATS_SIZE_CLASSES;
+    page->pid = getpid();
+    page->interval_ms = (uint32_t)stats_interval_ms;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(page->magic, STATS_MAGIC, sizeof(page->magic));
+    stats_page = page;
+}
+
+// Sum the shards one lock at a time, so publishing never stops every
+// thread at once, then write the page under the sequence counter
+static void publish_stats(int exited) {
+    tracker_totals_t totals;
+    sum_shards(&totals, 1);
+
+    stats_page_t *page = stats_page;
+    uint64_t sequence = page->sequence;
+    __atomic_store_n(&page->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    page->update_ns = monotonic_ns();
+    page->exited = exited;
+    page->total_allocated = totals.total_allocated;
+    page->total_freed = totals.total_freed;
+    page->current_usage = totals.current_usage;
+    page->peak_usage = totals.peak_usage;
+    page->allocation_count = totals.allocation_count;
+    page->free_count = totals.free_count;
+    for (int c = 0; c < STATS_SIZE_CLASSES; c++) {
+        page->live_by_class[c] = totals.live_by_class[c];
+        page->allocs_by_class[c] = totals.allocs_by_class[c];
+    }
+
+    __atomic_store_n(&page->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+static void *stats_main(void *arg) {
+    (void)arg;
+    struct timespec interval = { stats_interval_ms / 1000, (stats_interval_ms % 1000) * 1000000 };
+
+    in_tracker = 1;
+    while (!__atomic_load_n(&stats_stop, __ATOMIC_ACQUIRE)) {
+        publish_stats(0);
+        nanosleep(&interval, NULL);
+    }
+    return NULL;
+}
+
+static void start_stats(void) {
+    in_tracker = 1;
+    if (pthread_create(&stats_thread, NULL, stats_main, NULL) == 0) {
+        stats_running = 1;
+    } else {
+        fprintf(stderr, "Memory Tracker: Failed to start stats thread\n");
+    }
+    in_tracker = 0;
+}
+
+// Publish the final numbers and remove the file; monitors that already
+// mapped it keep reading them
+static void stop_stats(void) {
+    if (!stats_page) return;
+    if (stats_running) {
+        __atomic_store_n(&stats_stop, 1, __ATOMIC_RELEASE);
+        pthread_join(stats_thread, NULL);
+        stats_running = 0;
+    }
+    publish_stats(1);
+    unlink(stats_path);
+}
+
+// Look up the real allocator. Allocations dlsym makes meanwhile are served
+// by the bootstrap arena; nothing is published until every core entry
+// point is found.
+static int resolve_allocator(void) {
+    in_bootstrap = 1;
+    void *malloc_fn = dlsym(RTLD_NEXT, "malloc");
+    void *free_fn = dlsym(RTLD_NEXT, "free");
+    void *calloc_fn = dlsym(RTLD_NEXT, "calloc");
+    void *realloc_fn = dlsym(RTLD_NEXT, "realloc");
+
+    // The rest of the family is optional; missing entries fail like ENOMEM
+    void *posix_memalign_fn = dlsym(RTLD_NEXT, "posix_memalign");
+    void *aligned_alloc_fn = dlsym(RTLD_NEXT, "aligned_alloc");
+    void *memalign_fn = dlsym(RTLD_NEXT, "memalign");
+    void *valloc_fn = dlsym(RTLD_NEXT, "valloc");
+    void *pvalloc_fn = dlsym(RTLD_NEXT, "pvalloc");
+    void *malloc_usable_size_fn = dlsym(RTLD_NEXT, "malloc_usable_size");
+    in_bootstrap = 0;
+
+    if (!malloc_fn || !free_fn || !calloc_fn || !realloc_fn) return -1;
+
+    real_free = free_fn;
+    real_calloc = calloc_fn;
+    real_realloc = realloc_fn;
+    real_posix_memalign = posix_memalign_fn;
+    real_aligned_alloc = aligned_alloc_fn;
+    real_memalign = memalign_fn;
+    real_valloc = valloc_fn;
+    real_pvalloc = pvalloc_fn;
+    real_malloc_usable_size = malloc_usable_size_fn;
+    // Last: bootstrap_resolve treats a real malloc as "all resolved"
+    __atomic_store_n(&real_malloc, malloc_fn, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static void fork_prepare(void);
+static void fork_parent(void);
+static void fork_child(void);
+static void init_guard(unsigned long rate);
+static void init_quarantine(size_t budget);
+static void init_suppressions(const char *path);
+
+static void setup_tracker(void) {
+    if (resolve_allocator() != 0) {
+        fprintf(stderr, "Memory Tracker: Failed to get real function pointers\n");
+        return;
+    }
+    dl_iterate_phdr(find_self_text, NULL);
+
+    if (init_shards() != 0) {
+        fprintf(stderr, "Memory Tracker: Failed to allocate allocation table\n");
+        return;
+    }
+
+    // Check if we should enable tracking
+    char *env = getenv("MEMTRACK_ENABLE");
+    int enable = !(env && strcmp(env, "0") == 0);
+
+    if (pthread_key_create(&thread_key, release_thread_state) != 0) {
+        fprintf(stderr, "Memory Tracker: Failed to create thread key\n");
+        return;
+    }
+
+    // Buffered mode: threads append events to private rings that a
+    // background thread drains, keeping shard locks off the malloc path
+    env = getenv("MEMTRACK_BUFFERED");
+    if (env && strcmp(env, "1") == 0) {
+        buffered_mode = 1;
+    }
+
+    // Binary trace of every recorded event
+    env = getenv("MEMTRACK_TRACE");
+    if (env && *env) {
+        init_trace(env);
+        if (trace_fd >= 0) trace_path = env;
+    }
+
+    // Aggregate mode: keep per-callsite counters instead of a record per
+    // block. Chunk 0 is mapped up front so blocks without a stack (id 0)
+    // have counters too.
+    env = getenv("MEMTRACK_AGGREGATE");
+    if (env && strcmp(env, "1") == 0) {
+        aggregate_mode = 1;
+    }
+
+    // Periodic snapshots of the callsite counters, reporting callsites
+    // that grew in each of the last MEMTRACK_SNAPSHOT_GROWTH snapshots
+    env = getenv("MEMTRACK_SNAPSHOT_INTERVAL");
+    if (env && *env) {
+        double interval = strtod(env, NULL);
+        if (interval > 0) snapshot_interval = interval;
+    }
+    env = getenv("MEMTRACK_SNAPSHOT_GROWTH");
+    if (env && *env) {
+        unsigned long growth = strtoul(env, NULL, 10);
+        if (growth > 0) snapshot_growth = growth;
+    }
+
+    // Lifetime histograms need the birth time kept in full records
+    env = getenv("MEMTRACK_LIFETIMES");
+    if (env && strcmp(env, "1") == 0) {
+        if (aggregate_mode) {
+            fprintf(stderr, "Memory Tracker: MEMTRACK_LIFETIMES is not available in aggregate mode\n");
+        } else {
+            lifetime_mode = 1;
+        }
+    }
+
+    // Live counters page for external monitors: "1" for the default
+    // /dev/shm/memtrack.<pid>, anything else is the file to use
+    env = getenv("MEMTRACK_STATS");
+    if (env && *env) {
+        init_stats(strcmp(env, "1") == 0 ? NULL : env);
+        if (stats_page) stats_spec = env;
+    }
+
+    // Per-callsite realloc counts, moves, copy volume and growth factors
+    env = getenv("MEMTRACK_REALLOC");
+    if (env && strcmp(env, "1") == 0) {
+        realloc_mode = 1;
+    }
+
+    // Allocating thread by freeing thread, per callsite; the allocating
+    // thread lives in the full record
+    env = getenv("MEMTRACK_THREADS");
+    if (env && strcmp(env, "1") == 0) {
+        void *tids = mmap(NULL, sizeof(uint32_t) * (THREAD_INDEX_OVERFLOW + 1), PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        void *pairs = mmap(NULL, sizeof(thread_pair_t) * THREAD_PAIR_SLOTS, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (aggregate_mode) {
+            fprintf(stderr, "Memory Tracker: MEMTRACK_THREADS is not available in aggregate mode\n");
+        } else if (tids != MAP_FAILED && pairs != MAP_FAILED) {
+            thread_index_tids = tids;
+            thread_pairs = pairs;
+            thread_mode = 1;
+        }
+    }
+
+    if (aggregate_mode || snapshot_interval || lifetime_mode || realloc_mode) {
+        pthread_mutex_lock(&stack_table.lock);
+        if (map_stack_chunk(0) != 0) {
+            aggregate_mode = 0;
+            snapshot_interval = 0;
+            lifetime_mode = 0;
+            realloc_mode = 0;
+        }
+        pthread_mutex_unlock(&stack_table.lock);
+    }
+
+    // Sampling: record on average one allocation per MEMTRACK_SAMPLE_BYTES
+    env = getenv("MEMTRACK_SAMPLE_BYTES");
+    if (env && *env) {
+        double interval = strtod(env, NULL);
+        if (interval > 1) {
+            void *filter = mmap(NULL, (size_t)1 << SAMPLE_FILTER_BITS, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (filter != MAP_FAILED) {
+                sample_filter = filter;
+                sample_interval = interval;
+            }
+        }
+    }
+
+    // Guard-page sampling: about one allocation in MEMTRACK_GUARD_RATE gets
+    // a page of its own between inaccessible pages
+    env = getenv("MEMTRACK_GUARD_RATE");
+    if (env && *env && strtoul(env, NULL, 10) > 0) {
+        init_guard(strtoul(env, NULL, 10));
+    }
+
+    // Free quarantine: freed blocks are poisoned and held back from malloc,
+    // up to MEMTRACK_QUARANTINE bytes. It tells a bad free from a valid one
+    // by the live table, which sampling leaves mostly empty.
+    env = getenv("MEMTRACK_QUARANTINE");
+    if (env && *env && strtoull(env, NULL, 10) > 0) {
+        if (sample_interval) {
+            fprintf(stderr, "Memory Tracker: MEMTRACK_QUARANTINE ignored with MEMTRACK_SAMPLE_BYTES\n");
+        } else {
+            init_quarantine(strtoull(env, NULL, 10));
+        }
+    }
+
+    // Reachability leak check: the report scans memory for pointers and
+    // lists only blocks nothing points to. A sampled table misses most of
+    // the blocks pointers lead through.
+    env = getenv("MEMTRACK_REACHABILITY");
+    if (env && strcmp(env, "1") == 0) {
+        void *threads = mmap(NULL, sizeof(reach_thread_t) * REACH_MAX_THREADS, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (sample_interval) {
+            fprintf(stderr, "Memory Tracker: MEMTRACK_REACHABILITY ignored with MEMTRACK_SAMPLE_BYTES\n");
+            if (threads != MAP_FAILED) munmap(threads, sizeof(reach_thread_t) * REACH_MAX_THREADS);
+        } else if (threads != MAP_FAILED) {
+            reach_threads = threads;
+            reach_mode = 1;
+        }
+    }
+
+    // Heap profile exports written with every report: collapsed stacks
+    // for flame graphs and a pprof profile
+    env = getenv("MEMTRACK_COLLAPSED");
+    if (env && *env) {
+        collapsed_spec = env;
+        snprintf(collapsed_path, sizeof(collapsed_path), "%s", env);
+    }
+    env = getenv("MEMTRACK_COLLAPSED_VALUE");
+    if (env && *env) {
+        if (strcmp(env, "inuse_objects") == 0) {
+            collapsed_value = EXPORT_INUSE_OBJECTS;
+        } else if (strcmp(env, "alloc_space") == 0 || strcmp(env, "alloc_objects") == 0) {
+            if (aggregate_mode) {
+                collapsed_value = env[6] == 's' ? EXPORT_ALLOC_SPACE : EXPORT_ALLOC_OBJECTS;
+            } else {
+                fprintf(stderr, "Memory Tracker: MEMTRACK_COLLAPSED_VALUE=%s needs aggregate mode, using inuse_space\n", env);
+            }
+        } else if (strcmp(env, "inuse_space") != 0) {
+            fprintf(stderr, "Memory Tracker: Unknown MEMTRACK_COLLAPSED_VALUE %s, using inuse_space\n", env);
+        }
+    }
+    env = getenv("MEMTRACK_PPROF");
+    if (env && *env) {
+        pprof_spec = env;
+        snprintf(pprof_path, sizeof(pprof_path), "%s", env);
+    }
+
+    // Known leaks to leave out of reports, memcheck suppression format
+    env = getenv("MEMTRACK_SUPPRESSIONS");
+    if (env && *env) {
+        init_suppressions(env);
+    }
+
+    // Unwinder: glibc backtrace() by default, or the frame-pointer walker
+    // or cached CFI unwinder (set up by the constructor)
+    env = getenv("MEMTRACK_UNWIND");
+    if (env && strcmp(env, "fp") == 0) {
+        unwind_mode = UNWIND_FP;
+    } else if (env && strcmp(env, "cfi") == 0) {
+        unwind_mode = UNWIND_CFI;
+    }
+
+    clock_origin_ns = monotonic_ns();
+    clock_origin_time = time(NULL);
+
+    // Keep the tracker consistent across fork() in multithreaded processes
+    if (pthread_atfork(fork_prepare, fork_parent, fork_child) != 0) {
+        fprintf(stderr, "Memory Tracker: Failed to register fork handlers\n");
+    }
+
+    initialized = 1;
+    tracking_enabled = enable;
+
+    // Register signal handler for leak report
+    signal(SIGTERM, NULL);
+    signal(SIGINT, NULL);
+
+    fprintf(stderr, "Memory Tracker: Initialized (PID: %d)\n", getpid());
+}
+
+// Runs exactly once, from the constructor or from the first allocator call
+// that reaches a bootstrap stand-in, whichever comes first
+static void init_tracker(void) {
+    int was_in_tracker = in_tracker;
+    in_tracker = 1;
+    setup_tracker();
+    in_tracker = was_in_tracker;
+}
+
+// Check for a live allocation (caller holds shard->mutex)
+static int find_allocation(tracker_shard_t *shard, void *ptr) {
+    if (slot_table_find(&shard->table, (uintptr_t)ptr) >= 0) return 1;
+    return shard->old_table.slots && slot_table_find(&shard->old_table, (uintptr_t)ptr) >= 0;
+}
+
+// Fold this thread's batched bytes into the process usage and peak
+static void flush_usage_batch(void) {
+    long batch = thread_usage_batch;
+    thread_usage_batch = 0;
+    if (!batch) return;
+
+    long usage = __atomic_add_fetch(&process_usage, batch, __ATOMIC_RELAXED);
+    long peak = __atomic_load_n(&process_peak, __ATOMIC_RELAXED);
+    while (usage > peak && !__atomic_compare_exchange_n(&process_peak, &peak, usage, 1,
+                                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+// Count a change in live bytes towards the process peak. Threads only
+// touch the shared counter once their net change passes PEAK_BATCH_BYTES,
+// so the peak is approximate: off by less than that per thread.
+static void account_usage(long bytes) {
+    thread_usage_batch += bytes;
+    if (thread_usage_batch >= PEAK_BATCH_BYTES || thread_usage_batch <= -PEAK_BATCH_BYTES) {
+        flush_usage_batch();
+    }
+}
+
+// Add an allocation to the table (caller holds shard->mutex). In aggregate
+// mode the block only carries its size and stack id and its callsite
+// counters are bumped; otherwise a full record is kept.
+static void insert_allocation(tracker_shard_t *shard, void *ptr, size_t size,
+                              uint32_t stack_id, int api, uint64_t birth_ns, uint16_t thread) {
+    migrate_step(shard, TABLE_MIGRATE_BATCH);
+
+    slot_table_t *table = &shard->table;
+    if ((table->count + 1) * 100 > table->capacity * TABLE_MAX_LOAD_PERCENT) {
+        start_resize(shard);
+        if (table->count + 1 >= table->capacity) {
+            // Could not grow and no room left: drop the block
+            return;
+        }
+    }
+
+    // A packed block saturates its size field; count the same clamped
+    // size here that remove_allocation will decode
+    if (aggregate_mode && size > BLOCK_MAX_SIZE) size = BLOCK_MAX_SIZE;
+    size_t bytes = estimated_bytes(size);
+    size_t count = estimated_count(size);
+    table_slot_t entry;
+    entry.ptr = (uintptr_t)ptr;
+
+    if (aggregate_mode) {
+        entry.block = (uint64_t)size << BLOCK_SIZE_SHIFT | (uint64_t)api << BLOCK_ID_BITS | stack_id;
+    } else {
+        allocation_t *alloc = slab_alloc(&record_cache);
+        if (!alloc) return;
+        alloc->ptr = ptr;
+        alloc->size = size;
+        alloc->birth_ns = birth_ns;
+        alloc->thread = thread;
+        alloc->stack_id = stack_id;
+        alloc->api = api;
+        entry.alloc = alloc;
+    }
+    slot_table_put(table, entry);
+
+    // Callsites are shared between shards
+    callsite_t *site = callsite_get(stack_id);
+    if (site) {
+        __atomic_add_fetch(&site->live_bytes, bytes, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&site->live_count, count, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&site->total_allocated, bytes, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&site->allocation_count, count, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->api, api, __ATOMIC_RELAXED);
+    }
+
+    shard->total_allocated += bytes;
+    shard->current_usage += bytes;
+    shard->allocation_count += count;
+    if (stats_page) {
+        unsigned int size_class = stats_size_class(size);
+        shard->live_by_class[size_class] += count;
+        shard->allocs_by_class[size_class] += count;
+    }
+    account_usage((long)bytes);
+}
+
+// Remove an allocation from the table (caller holds shard->mutex). death_ns
+// is when the block was freed and thread the index of the thread that freed
+// it, 0 if unknown. Returns the API it was allocated with, or -1 if ptr is
+// not tracked.
+static int remove_allocation(tracker_shard_t *shard, void *ptr, uint64_t death_ns, uint16_t thread) {
+    table_slot_t removed;
+
+    migrate_step(shard, TABLE_MIGRATE_BATCH);
+
+    long i = slot_table_find(&shard->table, (uintptr_t)ptr);
+    if (i >= 0) {
+        removed = shard->table.slots[i];
+        slot_table_erase(&shard->table, (size_t)i);
+    } else if (shard->old_table.slots &&
+               (i = slot_table_find(&shard->old_table, (uintptr_t)ptr)) >= 0) {
+        removed = shard->old_table.slots[i];
+        shard->old_table.slots[i].ptr = SLOT_TOMBSTONE;
+        shard->old_table.count--;
+    } else {
+        return -1;
+    }
+
+    size_t size;
+    int api;
+    uint32_t stack_id;
+    if (aggregate_mode) {
+        size = removed.block >> BLOCK_SIZE_SHIFT;
+        api = (int)(removed.block >> BLOCK_ID_BITS) & ((1 << BLOCK_API_BITS) - 1);
+        stack_id = (uint32_t)(removed.block & ((1u << BLOCK_ID_BITS) - 1));
+    } else {
+        size = removed.alloc->size;
+        api = removed.alloc->api;
+        stack_id = removed.alloc->stack_id;
+        lifetime_hist_t *hist = lifetime_get(stack_id);
+        if (hist && death_ns >= removed.alloc->birth_ns) {
+            __atomic_add_fetch(&hist->buckets[lifetime_bucket(death_ns - removed.alloc->birth_ns)],
+                               estimated_count(size), __ATOMIC_RELAXED);
+        }
+        if (thread_mode && thread && removed.alloc->thread) {
+            count_thread_free(removed.alloc->thread, thread, stack_id, size);
+        }
+        slab_free(&record_cache, removed.alloc);
+    }
+
+    size_t bytes = estimated_bytes(size);
+    size_t count = estimated_count(size);
+
+    callsite_t *site = callsite_get(stack_id);
+    if (site) {
+        __atomic_sub_fetch(&site->live_bytes, bytes, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&site->live_count, count, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&site->total_freed, bytes, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&site->free_count, count, __ATOMIC_RELAXED);
+    }
+
+    shard->total_freed += bytes;
+    shard->current_usage -= bytes;
+    account_usage(-(long)bytes);
+    shard->free_count += count;
+    if (stats_page) {
+        shard->live_by_class[stats_size_class(size)] -= count;
+    }
+    if (sample_filter) sample_filter_remove(ptr);
+    return api;
+}
+
+// Visit every live allocation record (caller holds all shard locks; not
+// used in aggregate mode, which keeps no records)
+static void for_each_allocation(void (*fn)(allocation_t *alloc, void *arg), void *arg) {
+    for (unsigned int s = 0; s < tracker.shard_count; s++) {
+        slot_table_t *tables[2] = { &tracker.shards[s].table, &tracker.shards[s].old_table };
+
+        for (int t = 0; t < 2; t++) {
+            for (size_t i = 0; i < tables[t]->capacity; i++) {
+                uintptr_t ptr = tables[t]->slots[i].ptr;
+                if (ptr != SLOT_EMPTY && ptr != SLOT_TOMBSTONE) {
+                    fn(tables[t]->slots[i].alloc, arg);
+                }
+            }
+        }
+    }
+}
+
+// Add allocation to tracker
+static void track_allocation(void *ptr, size_t size, uint32_t stack_id, int api) {
+    uint64_t birth_ns = aggregate_mode ? 0 : monotonic_ns();
+    uint16_t thread = thread_mode ? current_thread_index() : 0;
+
+    tracker_shard_t *shard = shard_for(ptr);
+    pthread_mutex_lock(&shard->mutex);
+    insert_allocation(shard, ptr, size, stack_id, api, birth_ns, thread);
+    pthread_mutex_unlock(&shard->mutex);
+}
+
+// Remove allocation from tracker
+static void untrack_allocation(void *ptr, int dealloc) {
+    uint64_t death_ns = lifetime_mode ? monotonic_ns() : 0;
+    uint16_t thread = thread_mode ? current_thread_index() : 0;
+
+    tracker_shard_t *shard = shard_for(ptr);
+    pthread_mutex_lock(&shard->mutex);
+    int api = remove_allocation(shard, ptr, death_ns, thread);
+    pthread_mutex_unlock(&shard->mutex);
+
+    if (api < 0) warn_untracked_free(ptr);
+    else check_dealloc(ptr, api, dealloc);
+}
+
+// Remove and return the pending free for ptr, if any (caller holds drain_mutex)
+static pending_free_t *take_pending_free(void *ptr) {
+    pending_free_t **current = &pending_frees[(uintptr_t)ptr % PENDING_HASH_SIZE];
+
+    while (*current) {
+        if ((*current)->ptr == ptr) {
+            pending_free_t *found = *current;
+            *current = found->next;
+            return found;
+        }
+        current = &(*current)->next;
+    }
+    return NULL;
+}
+
+// Apply one buffered event to the live table (caller holds drain_mutex).
+// Returns 0 when the event depends on a free still sitting in another
+// thread's ring and must be retried on a later pass.
+static int apply_event(tracker_event_t *ev, int force) {
+    tracker_shard_t *shard = shard_for(ev->ptr);
+
+    if (ev->type == EVENT_ALLOC) {
+        pthread_mutex_lock(&shard->mutex);
+        if (find_allocation(shard, ev->ptr)) {
+            if (!force) {
+                pthread_mutex_unlock(&shard->mutex);
+                return 0;
+            }
+            // The old block was released without us seeing the free
+            remove_allocation(shard, ev->ptr, 0, 0);
+        }
+        pthread_mutex_unlock(&shard->mutex);
+
+        pending_free_t *pending = take_pending_free(ev->ptr);
+        if (pending && pending->clock_ns < ev->clock_ns) {
+            // The free predates this allocation, so it belonged to a block
+            // we never tracked
+            warn_untracked_free(pending->ptr);
+            slab_free(&pending_cache, pending);
+            pending = NULL;
+        }
+
+        pthread_mutex_lock(&shard->mutex);
+        insert_allocation(shard, ev->ptr, ev->size, ev->stack_id, ev->api, ev->clock_ns, ev->thread);
+        if (pending) {
+            // Freed on another thread before this allocation was drained
+            remove_allocation(shard, ev->ptr, pending->clock_ns, pending->thread);
+        }
+        pthread_mutex_unlock(&shard->mutex);
+
+        if (pending) {
+            check_dealloc(ev->ptr, ev->api, pending->dealloc);
+            slab_free(&pending_cache, pending);
+        }
+        return 1;
+    }
+
+    pthread_mutex_lock(&shard->mutex);
+    int api = remove_allocation(shard, ev->ptr, ev->clock_ns, ev->thread);
+    pthread_mutex_unlock(&shard->mutex);
+
+    if (api >= 0) {
+        check_dealloc(ev->ptr, api, ev->api);
+        return 1;
+    }
+
+    // The matching allocation may still be in another thread's ring
+    pending_free_t *pending = slab_alloc(&pending_cache);
+    if (pending) {
+        unsigned int index = (uintptr_t)ev->ptr % PENDING_HASH_SIZE;
+        pending->ptr = ev->ptr;
+        pending->clock_ns = ev->clock_ns;
+        pending->passes = 0;
+        pending->dealloc = ev->api;
+        pending->thread = ev->thread;
+        pending->next = pending_frees[index];
+        pending_frees[index] = pending;
+    }
+    return 1;
+}
+
+// Report frees that never found their allocation (caller holds drain_mutex)
+static void age_pending_frees(int final) {
+    for (int i = 0; i < PENDING_HASH_SIZE; i++) {
+        pending_free_t **current = &pending_frees[i];
+        while (*current) {
+            pending_free_t *pending = *current;
+            if (final || ++pending->passes > MAX_PENDING_PASSES) {
+                *current = pending->next;
+                warn_untracked_free(pending->ptr);
+                slab_free(&pending_cache, pending);
+            } else {
+                current = &pending->next;
+            }
+        }
+    }
+}
+
+// Drain every thread ring into the live table (caller holds drain_mutex).
+// Rings are consumed in order; an allocation whose address is still live is
+// left at the head of its ring until the matching free shows up elsewhere.
+static void drain_rings_locked(int final) {
+    int progress;
+    int stalled;
+    int force = 0;
+
+    do {
+        progress = 0;
+        stalled = 0;
+
+        for (event_ring_t *ring = __atomic_load_n(&ring_list, __ATOMIC_ACQUIRE);
+             ring; ring = ring->next) {
+            unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+            unsigned long tail = ring->tail;
+
+            while (tail != head) {
+                tracker_event_t *ev = &ring->events[tail & (EVENT_RING_SIZE - 1)];
+                int force_ring = force || ring->stalled_passes > MAX_STALL_PASSES;
+                if (!apply_event(ev, force_ring)) {
+                    stalled = 1;
+                    break;
+                }
+                tail++;
+                ring->stalled_passes = 0;
+                progress = 1;
+            }
+            __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+        }
+
+        // At exit nothing else will arrive, so break any remaining stalls
+        if (final && stalled && !progress && !force) {
+            force = 1;
+            progress = 1;
+        }
+    } while (stalled && progress);
+
+    if (stalled) {
+        for (event_ring_t *ring = ring_list; ring; ring = ring->next) {
+            if (ring->tail != __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+                ring->stalled_passes++;
+            }
+        }
+    }
+    age_pending_frees(final);
+}
+
+static void drain_rings(int final) {
+    int was_in_tracker = in_tracker;
+    in_tracker = 1;
+    pthread_mutex_lock(&drain_mutex);
+    drain_rings_locked(final);
+    pthread_mutex_unlock(&drain_mutex);
+    in_tracker = was_in_tracker;
+}
+
+// Thread exit: hand the ring back for reuse by a future thread and return
+// cached slab objects
+static void release_thread_state(void *arg) {
+    (void)arg;
+    thread_exiting = 1;
+    if (thread_ring) {
+        __atomic_store_n(&thread_ring->orphaned, 1, __ATOMIC_RELEASE);
+        thread_ring = NULL;
+    }
+    if (thread_cfi_cache) {
+        munmap(thread_cfi_cache, sizeof(cfi_rule_t) * CFI_CACHE_SIZE);
+        thread_cfi_cache = NULL;
+    }
+    trace_release_chunk();
+    slab_flush_thread();
+    flush_usage_batch();
+    if (thread_reach && thread_reach != &reach_unregistered) {
+        __atomic_store_n(&thread_reach->used, 0, __ATOMIC_RELEASE);
+    }
+    thread_reach = NULL;
+}
+
+// Get a ring for the calling thread, reusing one from an exited thread
+static event_ring_t *acquire_thread_ring(void) {
+    event_ring_t *ring;
+
+    for (ring = __atomic_load_n(&ring_list, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+        int expected = 1;
+        if (__atomic_compare_exchange_n(&ring->orphaned, &expected, 0, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    if (!ring) {
+        ring = mmap(NULL, sizeof(event_ring_t), PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring == MAP_FAILED) return NULL;
+
+        ring->next = __atomic_load_n(&ring_list, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&ring_list, &ring->next, ring, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+
+    register_thread();
+    thread_ring = ring;
+    return ring;
+}
+
+// Record an event from the application thread without taking a shared lock
+static void buffer_event(int type, int api, void *ptr, size_t size, uint32_t stack_id) {
+    tracker_event_t local;
+    tracker_event_t *ev = &local;
+    event_ring_t *ring = thread_ring;
+
+    if (!ring && !thread_exiting) {
+        ring = acquire_thread_ring();
+    }
+
+    if (ring) {
+        unsigned long head = ring->head;
+        while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= EVENT_RING_SIZE) {
+            // Full: drain inline rather than wait on an aggregator that
+            // may be busy, stalled or gone. A stalled ring is forced
+            // after MAX_STALL_PASSES drains, so this ends.
+            pthread_mutex_lock(&drain_mutex);
+            drain_rings_locked(0);
+            pthread_mutex_unlock(&drain_mutex);
+        }
+        ev = &ring->events[head & (EVENT_RING_SIZE - 1)];
+    }
+
+    ev->type = type;
+    ev->api = api;
+    ev->ptr = ptr;
+    ev->size = size;
+    ev->thread = thread_mode ? current_thread_index() : 0;
+    ev->stack_id = stack_id;
+    ev->clock_ns = monotonic_ns();
+
+    if (ring) {
+        __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+        return;
+    }
+
+    // Thread is past its ring destructor: flush everything older first so
+    // the event is applied in order
+    pthread_mutex_lock(&drain_mutex);
+    drain_rings_locked(0);
+    apply_event(ev, 1);
+    pthread_mutex_unlock(&drain_mutex);
+}
+
+static void *aggregator_main(void *arg) {
+    (void)arg;
+    struct timespec interval = { 0, AGGREGATOR_INTERVAL_NS };
+
+    in_tracker = 1;
+    while (!__atomic_load_n(&aggregator_stop, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&drain_mutex);
+        drain_rings_locked(0);
+        pthread_mutex_unlock(&drain_mutex);
+        nanosleep(&interval, NULL);
+    }
+    return NULL;
+}
+
+static void start_aggregator(void) {
+    in_tracker = 1;
+    if (pthread_create(&aggregator_thread, NULL, aggregator_main, NULL) == 0) {
+        aggregator_running = 1;
+    } else {
+        // Nothing would empty the rings: apply what is there and track
+        // directly from now on
+        fprintf(stderr, "Memory Tracker: Failed to start aggregator thread, buffering disabled\n");
+        drain_rings(1);
+        buffered_mode = 0;
+    }
+    in_tracker = 0;
+}
+
+static void stop_aggregator(void) {
+    if (!aggregator_running) return;
+    __atomic_store_n(&aggregator_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(aggregator_thread, NULL);
+    aggregator_running = 0;
+}
+
+static void finish_fork_child(void);
+
+// Drop a block on whichever path the current mode uses (caller sets in_tracker)
+static void forget_block(void *ptr, int dealloc) {
+    if (buffered_mode) {
+        buffer_event(EVENT_FREE, dealloc, ptr, 0, 0);
+    } else {
+        untrack_allocation(ptr, dealloc);
+    }
+}
+
+// The tracking_enabled load is all a disabled tracker costs per call
+static void record_free(void *ptr, int dealloc) {
+    if (!__atomic_load_n(&tracking_enabled, __ATOMIC_RELAXED) || in_tracker) return;
+    if (fork_child_pending) finish_fork_child();
+    if (sample_filter && !sample_filter_contains(ptr)) return;
+
+    in_tracker = 1;
+    if (reach_mode && !thread_reach) reach_register_thread();
+    forget_block(ptr, dealloc);
+    if (trace_fd >= 0) {
+        trace_event(TRACE_FREE, dealloc, ptr, NULL, 0, 0);
+    }
+    in_tracker = 0;
+}
+
+// Count one resize of a block whose usable size was old_size
+static void record_realloc_stats(uint32_t stack_id, void *ptr, size_t size,
+                                 void *old_ptr, size_t old_size) {
+    realloc_stats_t *stats = realloc_stats_get(stack_id);
+    if (!stats) return;
+
+    size_t weight = estimated_count(size);
+    __atomic_add_fetch(&stats->count, weight, __ATOMIC_RELAXED);
+    if (ptr != old_ptr) {
+        __atomic_add_fetch(&stats->moves, weight, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stats->bytes_copied, weight * (old_size < size ? old_size : size),
+                           __ATOMIC_RELAXED);
+    }
+    if (size <= old_size || old_size == 0) return;
+
+    double factor = (double)size / old_size;
+    int bucket = factor < 1.125 ? 0 : factor < 1.25 ? 1 : factor < 1.5 ? 2 :
+                 factor < 2 ? 3 : factor < 4 ? 4 : 5;
+    __atomic_add_fetch(&stats->grows, weight, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats->growth_bytes, weight * (size - old_size), __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats->growth_log2, weight * (size_t)(log2(factor) * 1024), __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats->factors[bucket], weight, __ATOMIC_RELAXED);
+}
+
+// Record an allocation on whichever path the current mode uses. For
+// realloc(), old_ptr is the block that was resized and old_size its usable
+// size; the old block is dropped first and the trace gets a single realloc
+// record.
+static void record_allocation(void *ptr, size_t size, int api, void *old_ptr, size_t old_size) {
+    if (!__atomic_load_n(&tracking_enabled, __ATOMIC_RELAXED) || in_tracker) return;
+    if (fork_child_pending) finish_fork_child();
+
+    int old_known = old_ptr && (!sample_filter || sample_filter_contains(old_ptr));
+    if (sample_interval && !sample_allocation(size)) {
+        // Unsampled allocations stop here
+        if (old_known) record_free(old_ptr, DEALLOC_FREE);
+        return;
+    }
+
+    in_tracker = 1;
+    if (reach_mode && !thread_reach) reach_register_thread();
+    if (old_known) forget_block(old_ptr, DEALLOC_FREE);
+    if (sample_filter) sample_filter_add(ptr);
+
+    uint32_t stack_id = capture_stack();
+    if (buffered_mode) {
+        buffer_event(EVENT_ALLOC, api, ptr, size, stack_id);
+    } else {
+        track_allocation(ptr, size, stack_id, api);
+    }
+    if (trace_fd >= 0) {
+        trace_event(old_ptr ? TRACE_REALLOC : TRACE_ALLOC, api, ptr, old_ptr, size, stack_id);
+    }
+    if (old_ptr && realloc_mode) {
+        record_realloc_stats(stack_id, ptr, size, old_ptr, old_size);
+    }
+    in_tracker = 0;
+}
+
+// Report-time symbolizer. Return addresses are resolved against the
+// executable mappings in /proc/self/maps and the ELF symbol tables of the
+// mapped files (plus DWARF line info through libbfd when built with it).
+// Modules and resolved addresses are cached across reports; the address
+// cache is dropped whenever the set of mappings changes.
+
+// One function symbol, by link-time address
+typedef struct {
+    uintptr_t value;
+    uintptr_t size;
+    const char *name;
+} elf_symbol_t;
+
+typedef struct {
+    uintptr_t vaddr;
+    uintptr_t offset;
+} elf_segment_t;
+
+// A mapped ELF file, loaded once per path
+typedef struct elf_module {
+    char *path;
+    void *image;            // Read-only mapping of the whole file
+    size_t image_size;
+    elf_symbol_t *symbols;  // Sorted by value
+    size_t symbol_count;
+    elf_segment_t *segments;
+    size_t segment_count;
+#ifdef MEMTRACK_HAVE_BFD
+    bfd *abfd;
+    asymbol **bfd_symbols;
+#endif
+    struct elf_module *next;
+} elf_module_t;
+
+// Executable address range of a module; bias converts to link-time addresses
+typedef struct {
+    uintptr_t start;
+    uintptr_t end;
+    uintptr_t bias;
+    uintptr_t offset;       // File offset mapped at start
+    const char *path;
+    elf_module_t *module;   // NULL if the file could not be read
+} map_range_t;
+
+typedef struct {
+    uintptr_t addr;
+    char *text;
+} symbol_slot_t;
+
+static elf_module_t *elf_modules = NULL;
+static map_range_t *map_ranges = NULL;
+static size_t map_range_count = 0;
+static uint64_t maps_hash = 0;
+static unsigned long long maps_dl_adds = 0;     // Loader counters when the ranges were built
+static unsigned long long maps_dl_subs = 0;
+static symbol_slot_t *symbol_cache = NULL;
+static size_t symbol_cache_capacity = 0;   // Power of two
+static size_t symbol_cache_count = 0;
+
+static int compare_symbols(const void *a, const void *b) {
+    uintptr_t value_a = ((const elf_symbol_t *)a)->value;
+    uintptr_t value_b = ((const elf_symbol_t *)b)->value;
+    return value_a < value_b ? -1 : value_a > value_b ? 1 : 0;
+}
+
+// Collect the function symbols of one symbol table section
+static void load_symbol_table(elf_module_t *module, const ElfW(Shdr) *sections, int index) {
+    const char *image = module->image;
+    const ElfW(Shdr) *symtab = &sections[index];
+    const ElfW(Shdr) *strtab = &sections[symtab->sh_link];
+    size_t count = symtab->sh_size / sizeof(ElfW(Sym));
+    const ElfW(Sym) *syms = (const ElfW(Sym) *)(image + symtab->sh_offset);
+
+    if (symtab->sh_offset + symtab->sh_size > module->image_size ||
+        strtab->sh_offset + strtab->sh_size > module->image_size) {
+        return;
+    }
+
+    elf_symbol_t *symbols = malloc(sizeof(elf_symbol_t) * (count ? count : 1));
+    if (!symbols) return;
+
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (ELF64_ST_TYPE(syms[i].st_info) != STT_FUNC || syms[i].st_shndx == SHN_UNDEF ||
+            syms[i].st_value == 0 || syms[i].st_name >= strtab->sh_size) {
+            continue;
+        }
+        symbols[kept].value = syms[i].st_value;
+        symbols[kept].size = syms[i].st_size;
+        symbols[kept].name = image + strtab->sh_offset + syms[i].st_name;
+        kept++;
+    }
+    qsort(symbols, kept, sizeof(elf_symbol_t), compare_symbols);
+    module->symbols = symbols;
+    module->symbol_count = kept;
+}
+
+#ifdef MEMTRACK_HAVE_BFD
+// Open the module with libbfd for DWARF line lookups
+static void open_bfd_module(elf_module_t *module) {
+    static int bfd_ready = 0;
+    if (!bfd_ready) {
+        bfd_init();
+        bfd_ready = 1;
+    }
+
+    bfd *abfd = bfd_openr(module->path, NULL);
+    if (!abfd) return;
+    abfd->flags |= BFD_DECOMPRESS;
+    if (!bfd_check_format(abfd, bfd_object)) {
+        bfd_close(abfd);
+        return;
+    }
+
+    long size = bfd_get_symtab_upper_bound(abfd);
+    if (size > 0) {
+        module->bfd_symbols = malloc(size);
+        if (module->bfd_symbols && bfd_canonicalize_symtab(abfd, module->bfd_symbols) < 0) {
+            free(module->bfd_symbols);
+            module->bfd_symbols = NULL;
+        }
+    }
+    module->abfd = abfd;
+}
+
+// Source file and line of a link-time address
+static int bfd_source_line(elf_module_t *module, uintptr_t vaddr,
+                           const char **file, unsigned int *line) {
+    if (!module->abfd) return 0;
+
+    for (asection *section = module->abfd->sections; section; section = section->next) {
+        if (!(bfd_section_flags(section) & SEC_ALLOC)) continue;
+
+        bfd_vma vma = bfd_section_vma(section);
+        if (vaddr < vma || vaddr >= vma + bfd_section_size(section)) continue;
+
+        const char *function;
+        return bfd_find_nearest_line(module->abfd, section, module->bfd_symbols, vaddr - vma,
+                                     file, &function, line) && *file && *line;
+    }
+    return 0;
+}
+#endif
+
+// Load a module's symbols and segments, or find it in the cache
+static elf_module_t *load_elf_module(const char *path) {
+    elf_module_t *module;
+    for (module = elf_modules; module; module = module->next) {
+        if (strcmp(module->path, path) == 0) return module;
+    }
+
+    module = calloc(1, sizeof(elf_module_t));
+    if (!module) return NULL;
+    module->path = strdup(path);
+    module->next = elf_modules;
+    elf_modules = module;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return module;
+    off_t size = lseek(fd, 0, SEEK_END);
+    void *image = size > 0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (image == MAP_FAILED) return module;
+
+    const ElfW(Ehdr) *ehdr = image;
+    if ((size_t)size < sizeof(*ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+        ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+        ehdr->e_phoff + ehdr->e_phnum * sizeof(ElfW(Phdr)) > (size_t)size ||
+        ehdr->e_shoff + ehdr->e_shnum * sizeof(ElfW(Shdr)) > (size_t)size) {
+        munmap(image, size);
+        return module;
+    }
+    module->image = image;
+    module->image_size = size;
+
+    const ElfW(Phdr) *phdrs = (const ElfW(Phdr) *)((const char *)image + ehdr->e_phoff);
+    module->segments = malloc(sizeof(elf_segment_t) * (ehdr->e_phnum ? ehdr->e_phnum : 1));
+    for (int i = 0; module->segments && i < ehdr->e_phnum; i++) {
+        if (phdrs[i].p_type == PT_LOAD) {
+            module->segments[module->segment_count].vaddr = phdrs[i].p_vaddr;
+            module->segments[module->segment_count].offset = phdrs[i].p_offset;
+            module->segment_count++;
+        }
+    }
+
+    // Prefer the full symbol table; stripped files only have .dynsym
+    const ElfW(Shdr) *sections = (const ElfW(Shdr) *)((const char *)image + ehdr->e_shoff);
+    int dynsym = -1;
+    for (int i = 0; i < ehdr->e_shnum && !module->symbols; i++) {
+        if (sections[i].sh_type == SHT_SYMTAB) load_symbol_table(module, sections, i);
+        else if (sections[i].sh_type == SHT_DYNSYM) dynsym = i;
+    }
+    if (!module->symbols && dynsym >= 0) {
+        load_symbol_table(module, sections, dynsym);
+    }
+
+#ifdef MEMTRACK_HAVE_BFD
+    open_bfd_module(module);
+#endif
+    return module;
+}
+
+static void clear_symbol_cache(void) {
+    for (size_t i = 0; i < symbol_cache_capacity; i++) {
+        free(symbol_cache[i].text);
+    }
+    free(symbol_cache);
+    symbol_cache = NULL;
+    symbol_cache_capacity = symbol_cache_count = 0;
+}
+
+static int read_dl_counters(struct dl_phdr_info *info, size_t size, void *data) {
+    unsigned long long *counters = data;
+    if (size < offsetof(struct dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs)) return 1;
+    counters[0] = info->dlpi_adds;
+    counters[1] = info->dlpi_subs;
+    return 1;
+}
+
+// Rebuild the range index if the code mappings changed since the last
+// report. Modules only come and go through the loader, so nothing is read
+// while its load and unload counts stand still; otherwise only executable
+// file mappings count, and anonymous ones (the guard pool's mprotects,
+// thread stacks) never invalidate the caches.
+static void refresh_map_ranges(void) {
+    unsigned long long counters[2] = { 0, 0 };
+    dl_iterate_phdr(read_dl_counters, counters);
+    if (map_ranges && counters[0] && counters[0] == maps_dl_adds && counters[1] == maps_dl_subs) {
+        return;
+    }
+
+    int fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+
+    size_t capacity = 65536, length = 0;
+    char *text = malloc(capacity + 1);
+    ssize_t n;
+    while (text && (n = read(fd, text + length, capacity - length)) > 0) {
+        length += n;
+        if (length == capacity) {
+            char *bigger = realloc(text, capacity * 2 + 1);
+            if (!bigger) break;
+            text = bigger;
+            capacity *= 2;
+        }
+    }
+    close(fd);
+    if (!text) return;
+    text[length] = '\0';
+
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (char *line = text; line < text + length;) {
+        char *eol = memchr(line, '\n', text + length - line);
+        char *end = eol ? eol : text + length;
+        char *perms = memchr(line, ' ', end - line);
+        if (perms && end - perms > 4 && perms[3] == 'x' && memchr(perms, '/', end - perms)) {
+            for (char *c = line; c < end; c++) {
+                hash = (hash ^ (unsigned char)*c) * 0x100000001b3ull;
+            }
+        }
+        line = end + 1;
+    }
+    maps_dl_adds = counters[0];
+    maps_dl_subs = counters[1];
+    if (map_ranges && hash == maps_hash) {
+        free(text);
+        return;
+    }
+
+    size_t lines = 0;
+    for (size_t i = 0; i < length; i++) lines += text[i] == '\n';
+    map_range_t *ranges = malloc(sizeof(map_range_t) * (lines + 1));
+    size_t count = 0;
+
+    for (char *line = text; ranges && line < text + length;) {
+        char *eol = strchr(line, '\n');
+        if (eol) *eol = '\0';
+
+        unsigned long start, end, offset;
+        char perms[5];
+        int path_at = 0;
+        if (sscanf(line, "%lx-%lx %4s %lx %*s %*s %n", &start, &end, perms, &offset, &path_at) == 4 &&
+            perms[2] == 'x' && path_at > 0 && line[path_at] == '/') {
+            elf_module_t *module = load_elf_module(line + path_at);
+            map_range_t *range = &ranges[count++];
+            range->start = start;
+            range->end = end;
+            range->bias = start - offset;
+            range->offset = offset;
+            range->path = module ? module->path : "??";
+            range->module = module;
+
+            // The link-time address of the segment mapped at this offset
+            for (size_t i = 0; module && i < module->segment_count; i++) {
+                elf_segment_t *segment = &module->segments[i];
+                uintptr_t page = (uintptr_t)getpagesize() - 1;
+                if ((segment->offset & ~page) == offset) {
+                    range->bias = start - (segment->vaddr & ~page);
+                    break;
+                }
+            }
+        }
+        line = eol ? eol + 1 : text + length;
+    }
+    free(text);
+
+    free(map_ranges);
+    map_ranges = ranges;
+    map_range_count = ranges ? count : 0;
+    maps_hash = hash;
+    clear_symbol_cache();
+}
+
+static map_range_t *find_map_range(uintptr_t addr) {
+    size_t low = 0, high = map_range_count;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (addr < map_ranges[mid].start) high = mid;
+        else if (addr >= map_ranges[mid].end) low = mid + 1;
+        else return &map_ranges[mid];
+    }
+    return NULL;
+}
+
+// Nearest function symbol at or below a link-time address
+static elf_symbol_t *find_symbol(elf_module_t *module, uintptr_t vaddr) {
+    size_t low = 0, high = module->symbol_count;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (module->symbols[mid].value <= vaddr) low = mid + 1;
+        else high = mid;
+    }
+    if (low == 0) return NULL;
+
+    elf_symbol_t *symbol = &module->symbols[low - 1];
+    if (symbol->size && vaddr >= symbol->value + symbol->size) return NULL;
+    return symbol;
+}
+
+// Demangled C++ symbol name to free, or NULL for other names
+static char *demangle_symbol(const char *name) {
+    typedef char *(*demangle_fn)(const char *, char *, size_t *, int *);
+    static demangle_fn demangle = NULL;
+    static int demangle_looked_up = 0;
+    if (!demangle_looked_up) {
+        demangle = (demangle_fn)dlsym(RTLD_DEFAULT, "__cxa_demangle");
+        demangle_looked_up = 1;
+    }
+
+    int status = -1;
+    char *demangled = demangle && name[0] == '_' && name[1] == 'Z' ? demangle(name, NULL, NULL, &status) : NULL;
+    if (status != 0) {
+        free(demangled);
+        return NULL;
+    }
+    return demangled;
+}
+
+// Format one return address as "module(function+0x1f) [addr] at file:line"
+static char *describe_address(uintptr_t addr) {
+    map_range_t *range = find_map_range(addr);
+    char buffer[1024];
+    if (!range) {
+        snprintf(buffer, sizeof(buffer), "[%p]", (void *)addr);
+        return strdup(buffer);
+    }
+
+    // Look up the call instruction, not the one after it
+    uintptr_t vaddr = addr - range->bias;
+    elf_symbol_t *symbol = range->module ? find_symbol(range->module, vaddr - 1) : NULL;
+    int length;
+    if (symbol) {
+        char *demangled = demangle_symbol(symbol->name);
+        length = snprintf(buffer, sizeof(buffer), "%s(%s+0x%lx) [%p]", range->path,
+                          demangled ? demangled : symbol->name,
+                          (unsigned long)(vaddr - symbol->value), (void *)addr);
+        free(demangled);
+    } else {
+        length = snprintf(buffer, sizeof(buffer), "%s(+0x%lx) [%p]", range->path,
+                          (unsigned long)vaddr, (void *)addr);
+    }
+
+#ifdef MEMTRACK_HAVE_BFD
+    const char *file;
+    unsigned int line;
+    if (range->module && length > 0 && (size_t)length < sizeof(buffer) &&
+        bfd_source_line(range->module, vaddr - 1, &file, &line)) {
+        snprintf(buffer + length, sizeof(buffer) - length, " at %s:%u", file, line);
+    }
+#else
+    (void)length;
+#endif
+    return strdup(buffer);
+}
+
+static symbol_slot_t *symbol_cache_slot(uintptr_t addr) {
+    size_t mask = symbol_cache_capacity - 1;
+    size_t i = hash_ptr(addr) & mask;
+    while (symbol_cache[i].addr && symbol_cache[i].addr != addr) {
+        i = (i + 1) & mask;
+    }
+    return &symbol_cache[i];
+}
+
+static int symbol_cache_reserve(size_t extra) {
+    if ((symbol_cache_count + extra) * 2 <= symbol_cache_capacity) return 0;
+
+    size_t capacity = symbol_cache_capacity ? symbol_cache_capacity : 1024;
+    while ((symbol_cache_count + extra) * 2 > capacity) capacity *= 2;
+
+    symbol_slot_t *old = symbol_cache;
+    size_t old_capacity = symbol_cache_capacity;
+    symbol_cache = calloc(capacity, sizeof(symbol_slot_t));
+    if (!symbol_cache) {
+        symbol_cache = old;
+        return -1;
+    }
+    symbol_cache_capacity = capacity;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].addr) *symbol_cache_slot(old[i].addr) = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+static int compare_addresses(const void *a, const void *b) {
+    uintptr_t addr_a = *(const uintptr_t *)a;
+    uintptr_t addr_b = *(const uintptr_t *)b;
+    return addr_a < addr_b ? -1 : addr_a > addr_b ? 1 : 0;
+}
+
+// Resolve the unique frames of the given stacks in one pass, in address
+// order so consecutive lookups hit the same module
+static void symbolize_stacks(const uint32_t *ids, uint32_t count) {
+    size_t total = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (ids[i]) total += stack_trace_get(ids[i])->depth;
+    }
+
+    uintptr_t *addrs = malloc(sizeof(uintptr_t) * (total ? total : 1));
+    if (!addrs) return;
+
+    size_t n = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!ids[i]) continue;
+        stack_trace_t *trace = stack_trace_get(ids[i]);
+        for (uint32_t j = 0; j < trace->depth; j++) {
+            addrs[n++] = (uintptr_t)trace->frames[j];
+        }
+    }
+    qsort(addrs, n, sizeof(uintptr_t), compare_addresses);
+
+    refresh_map_ranges();
+    if (symbol_cache_reserve(n) == 0) {
+        for (size_t i = 0; i < n; i++) {
+            if (!addrs[i] || (i > 0 && addrs[i] == addrs[i - 1])) continue;
+
+            symbol_slot_t *slot = symbol_cache_slot(addrs[i]);
+            if (slot->addr) continue;
+            slot->text = describe_address(addrs[i]);
+            if (slot->text) {
+                slot->addr = addrs[i];
+                symbol_cache_count++;
+            }
+        }
+    }
+    free(addrs);
+}
+
+static void print_stack(uint32_t id) {
+    if (id == 0) return;
+
+    stack_trace_t *trace = stack_trace_get(id);
+    for (uint32_t j = 0; j < trace->depth; j++) {
+        uintptr_t addr = (uintptr_t)trace->frames[j];
+        symbol_slot_t *slot = symbol_cache ? symbol_cache_slot(addr) : NULL;
+        if (slot && slot->addr) {
+            fprintf(stderr, "    %s\n", slot->text);
+        } else {
+            fprintf(stderr, "    [%p]\n", (void *)addr);
+        }
+    }
+}
+
+// Leak suppressions (MEMTRACK_SUPPRESSIONS). Entries use memcheck's format:
+//
+//   {
+//      name
+//      Memcheck:Leak
+//      match-leak-kinds: definite,possible
+//      fun:malloc
+//      ...
+//      obj:*/libfoo.so*
+//   }
+//
+// fun: matches a function name (mangled or demangled) and obj: a module
+// path, both with * and ? wildcards; "..." matches any number of frames.
+// An entry suppresses a stack whose frames, from the allocator entry point
+// outwards, start with its lines. The entries are compiled at startup into
+// a trie of frame lines, so entries sharing leading frames are matched
+// together, and every stack is matched once and its result kept by id.
+
+typedef enum {
+    SUPPRESS_ROOT = 0,
+    SUPPRESS_FUN,
+    SUPPRESS_OBJ,
+    SUPPRESS_ANY            // "..."
+} suppress_type_t;
+
+// One frame line, shared by every entry with the same lines before it
+typedef struct {
+    const char *pattern;
+    uint32_t child;         // First child, 0 for none (the root is nobody's child)
+    uint32_t sibling;
+    uint8_t type;           // suppress_type_t
+    uint8_t kinds;          // Leak kinds of the entries ending here
+} suppress_node_t;
+
+static char *suppress_text = NULL;          // The file, patterns point into it
+static suppress_node_t *suppress_nodes = NULL;
+static uint32_t suppress_node_count = 0;
+static size_t suppress_rule_count = 0;
+static uint32_t *suppress_sets[2];          // Matching: trie nodes reached so far
+static uint32_t *suppress_seen = NULL;      // Generation a node was last added in
+static uint32_t suppress_generation = 0;
+static uint8_t *suppress_memo = NULL;       // Per stack id: SUPPRESS_MEMO_DONE | kinds
+static uint32_t suppress_memo_size = 0;
+
+// Shell-style match with * and ?
+static int wildcard_match(const char *pattern, const char *text) {
+    const char *star = NULL, *resume = NULL;
+
+    while (*text) {
+        if (*pattern == '*') {
+            star = pattern++;
+            resume = text;
+        } else if (*pattern == '?' || *pattern == *text) {
+            pattern++;
+            text++;
+        } else if (star) {
+            pattern = star + 1;
+            text = ++resume;
+        } else {
+            return 0;
+        }
+    }
+    while (*pattern == '*') pattern++;
+    return *pattern == '\0';
+}
+
+// Child of parent for a frame line, added if no entry had it yet
+static uint32_t suppress_child(uint32_t parent, int type, const char *pattern) {
+    for (uint32_t c = suppress_nodes[parent].child; c; c = suppress_nodes[c].sibling) {
+        suppress_node_t *node = &suppress_nodes[c];
+        if (node->type == type && (type == SUPPRESS_ANY || strcmp(node->pattern, pattern) == 0)) return c;
+    }
+
+    suppress_node_t *node = &suppress_nodes[suppress_node_count];
+    node->pattern = pattern;
+    node->type = (uint8_t)type;
+    node->sibling = suppress_nodes[parent].child;
+    suppress_nodes[parent].child = suppress_node_count;
+    return suppress_node_count++;
+}
+
+// Leak kinds named in a match-leak-kinds line, 0 if one is unknown
+static uint8_t parse_leak_kinds(char *list) {
+    uint8_t kinds = 0;
+
+    for (char *name = strtok(list, ", \t"); name; name = strtok(NULL, ", \t")) {
+        if (strcmp(name, "definite") == 0) kinds |= 1u << REACH_DEFINITE;
+        else if (strcmp(name, "indirect") == 0) kinds |= 1u << REACH_INDIRECT;
+        else if (strcmp(name, "possible") == 0) kinds |= 1u << REACH_POSSIBLE;
+        else if (strcmp(name, "reachable") == 0) kinds |= 1u << REACH_REACHABLE;
+        else if (strcmp(name, "all") == 0) kinds |= SUPPRESS_ALL_KINDS;
+        else return 0;
+    }
+    return kinds;
+}
+
+static void *suppress_map(size_t size) {
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return memory == MAP_FAILED ? NULL : memory;
+}
+
+// Read and compile the suppressions file. Malformed entries are reported
+// and skipped, and so are entries for errors other than leaks.
+static void init_suppressions(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Memory Tracker: Cannot read suppressions from %s\n", path);
+        if (fd >= 0) close(fd);
+        return;
+    }
+
+    size_t length = (size_t)st.st_size, got = 0;
+    char *text = suppress_map(length + 1);
+    while (text && got < length) {
+        ssize_t n = read(fd, text + got, length - got);
+        if (n <= 0) break;
+        got += (size_t)n;
+    }
+    close(fd);
+    if (!text) return;
+    length = got;
+
+    size_t lines = 1;
+    for (size_t i = 0; i < length; i++) lines += text[i] == '\n';
+    suppress_nodes = suppress_map(sizeof(suppress_node_t) * (lines + 1));
+    suppress_sets[0] = suppress_map(sizeof(uint32_t) * (lines + 1));
+    suppress_sets[1] = suppress_map(sizeof(uint32_t) * (lines + 1));
+    suppress_seen = suppress_map(sizeof(uint32_t) * (lines + 1));
+    if (!suppress_nodes || !suppress_sets[0] || !suppress_sets[1] || !suppress_seen) {
+        fprintf(stderr, "Memory Tracker: Failed to allocate suppressions\n");
+        return;
+    }
+    suppress_node_count = 1;
+
+    enum { OUTSIDE, NAME, KIND, FRAMES } state = OUTSIDE;
+    int usable = 0;             // A leak entry without errors so far
+    uint8_t kinds = 0;
+    uint32_t node = 0;
+    size_t frames = 0, line_number = 0;
+    const char *problem = NULL;
+
+    for (char *line = text; line < text + length;) {
+        char *eol = memchr(line, '\n', (size_t)(text + length - line));
+        char *next = eol ? eol + 1 : text + length;
+        if (eol) *eol = '\0';
+        line_number++;
+
+        char *end = line + strlen(line);
+        while (end > line && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) *--end = '\0';
+        while (*line == ' ' || *line == '\t') line++;
+        if (*line == '\0' || *line == '#') {
+            line = next;
+            continue;
+        }
+
+        if (state == OUTSIDE) {
+            if (strcmp(line, "{") == 0) state = NAME;
+            else problem = "expected '{'";
+        } else if (state == NAME) {
+            state = KIND;
+        } else if (state == KIND) {
+            size_t kind_length = strlen(line);
+            usable = kind_length >= 5 && strcmp(line + kind_length - 5, ":Leak") == 0;
+            kinds = SUPPRESS_ALL_KINDS;
+            node = 0;
+            frames = 0;
+            state = FRAMES;
+        } else if (strcmp(line, "}") == 0) {
+            if (usable && frames) {
+                suppress_nodes[node].kinds |= kinds;
+                suppress_rule_count++;
+            } else if (usable) {
+                problem = "entry has no frames";
+            }
+            state = OUTSIDE;
+        } else if (!usable) {
+            // Skipping the rest of the entry
+        } else if (strncmp(line, "match-leak-kinds:", 17) == 0) {
+            kinds = parse_leak_kinds(line + 17);
+            if (!kinds) problem = "unknown leak kind";
+        } else if (strcmp(line, "...") == 0) {
+            node = suppress_child(node, SUPPRESS_ANY, NULL);
+            frames++;
+        } else if (strncmp(line, "fun:", 4) == 0 || strncmp(line, "obj:", 4) == 0) {
+            node = suppress_child(node, line[0] == 'f' ? SUPPRESS_FUN : SUPPRESS_OBJ, line + 4);
+            frames++;
+        } else {
+            problem = "unsupported frame line";
+        }
+
+        if (problem) {
+            fprintf(stderr, "Memory Tracker: %s:%zu: %s, entry skipped\n", path, line_number, problem);
+            usable = 0;
+            problem = NULL;
+        }
+        line = next;
+    }
+    if (state != OUTSIDE) {
+        fprintf(stderr, "Memory Tracker: %s: last entry not closed, skipped\n", path);
+    }
+
+    suppress_text = text;
+    fprintf(stderr, "Memory Tracker: Loaded %zu leak suppressions from %s\n", suppress_rule_count, path);
+}
+
+// Start an empty set of trie nodes
+static void suppress_new_set(void) {
+    if (++suppress_generation == 0) {
+        memset(suppress_seen, 0, sizeof(uint32_t) * suppress_node_count);
+        suppress_generation = 1;
+    }
+}
+
+// Add a node to the set, along with the "..." lines after it, which may
+// match no frame at all
+static void suppress_add(uint32_t node, uint32_t *set, uint32_t *count, uint8_t *kinds) {
+    if (suppress_seen[node] == suppress_generation) return;
+    suppress_seen[node] = suppress_generation;
+    set[(*count)++] = node;
+    *kinds |= suppress_nodes[node].kinds;
+
+    for (uint32_t c = suppress_nodes[node].child; c; c = suppress_nodes[c].sibling) {
+        if (suppress_nodes[c].type == SUPPRESS_ANY) suppress_add(c, set, count, kinds);
+    }
+}
+
+// Run one stack through the trie: the nodes reached after each frame are
+// the partial matches, and reaching the end of an entry suppresses its
+// kinds (caller holds symbolizer_lock, with the map ranges refreshed).
+// Captured stacks start at the caller, so the entry point the block came
+// from is matched first, as the tracker's own frame named after api.
+static uint8_t match_suppressions(uint32_t id, int api) {
+    stack_trace_t *trace = stack_trace_get(id);
+    map_range_t *self = find_map_range((uintptr_t)match_suppressions);
+
+    uint32_t *set = suppress_sets[0], *next = suppress_sets[1], count = 0;
+    uint8_t kinds = 0;
+    suppress_new_set();
+    suppress_add(0, set, &count, &kinds);
+
+    // Frame j is trace frame j - 1; frame 0 is the entry point
+    for (uint32_t j = api >= 0 ? 0 : 1; j <= trace->depth && count; j++) {
+        const char *object = self ? self->path : "???";
+        const char *function = j == 0 ? api_symbols[api] : "???";
+        if (j > 0) {
+            uintptr_t addr = (uintptr_t)trace->frames[j - 1];
+            map_range_t *range = find_map_range(addr);
+            elf_symbol_t *symbol = range && range->module ? find_symbol(range->module, addr - range->bias - 1) : NULL;
+            object = range ? range->path : "???";
+            if (symbol) function = symbol->name;
+        }
+        char *demangled = NULL;
+        int demangle_tried = 0;
+
+        uint32_t next_count = 0;
+        suppress_new_set();
+        for (uint32_t i = 0; i < count; i++) {
+            if (suppress_nodes[set[i]].type == SUPPRESS_ANY) suppress_add(set[i], next, &next_count, &kinds);
+
+            for (uint32_t c = suppress_nodes[set[i]].child; c; c = suppress_nodes[c].sibling) {
+                suppress_node_t *node = &suppress_nodes[c];
+                int matched = 0;
+                if (node->type == SUPPRESS_OBJ) {
+                    matched = wildcard_match(node->pattern, object);
+                } else if (node->type == SUPPRESS_FUN) {
+                    matched = wildcard_match(node->pattern, function);
+                    if (!matched && !demangle_tried) {
+                        demangled = demangle_symbol(function);
+                        demangle_tried = 1;
+                    }
+                    if (!matched && demangled) matched = wildcard_match(node->pattern, demangled);
+                }
+                if (matched) suppress_add(c, next, &next_count, &kinds);
+            }
+        }
+        free(demangled);
+
+        uint32_t *swap = set;
+        set = next;
+        next = swap;
+        count = next_count;
+    }
+    return kinds;
+}
+
+// Size the memo for the stacks recorded so far and refresh the module map
+// before a report matches stacks (caller holds symbolizer_lock). Results
+// are dropped when the mappings change, as frames may now resolve
+// differently.
+static void prepare_suppressions(void) {
+    if (!suppress_rule_count) return;
+
+    uint32_t stack_count = __atomic_load_n(&stack_table.count, __ATOMIC_ACQUIRE);
+    if (stack_count > suppress_memo_size) {
+        uint8_t *memo = realloc(suppress_memo, stack_count);
+        if (memo) {
+            memset(memo + suppress_memo_size, 0, stack_count - suppress_memo_size);
+            suppress_memo = memo;
+            suppress_memo_size = stack_count;
+        }
+    }
+
+    uint64_t hash = maps_hash;
+    refresh_map_ranges();
+    if (maps_hash != hash && suppress_memo) memset(suppress_memo, 0, suppress_memo_size);
+}
+
+// Leak kinds suppressed for a stack, matched on first use; a call site
+// allocates through one API, so the first block's names the entry point
+// (caller holds symbolizer_lock and called prepare_suppressions for this
+// report)
+static uint8_t suppressed_kinds(uint32_t id, int api) {
+    if (!suppress_rule_count || id == 0 || id >= suppress_memo_size) return 0;
+    if (!suppress_memo[id]) suppress_memo[id] = SUPPRESS_MEMO_DONE | match_suppressions(id, api);
+    return suppress_memo[id] & ~SUPPRESS_MEMO_DONE;
+}
+
+// Leaked bytes and blocks grouped by allocation stack
+typedef struct {
+    size_t bytes;
+    size_t blocks;
+    void *first_ptr;
+    uint64_t first_birth_ns;
+    int api;                // Entry point of the first block
+    callsite_t site;        // Aggregate mode: copy of the callsite counters
+} leak_group_t;
+
+typedef struct {
+    leak_group_t *groups;   // Indexed by stack id
+    uint32_t *order;        // Stack ids with leaks, sorted for printing
+    uint32_t count;
+    uint32_t stack_count;   // Size of groups
+} leak_groups_t;
+
+static void group_block(leak_groups_t *leaks, uint32_t stack_id, void *ptr, size_t size,
+                        uint64_t birth_ns, int api) {
+    leak_group_t *group = &leaks->groups[stack_id];
+
+    if (group->blocks == 0 || birth_ns < group->first_birth_ns) {
+        group->first_ptr = ptr;
+        group->first_birth_ns = birth_ns;
+        group->api = api;
+    }
+    group->bytes += estimated_bytes(size);
+    group->blocks += estimated_count(size);
+}
+
+static void group_leak(allocation_t *alloc, void *arg) {
+    group_block(arg, alloc->stack_id, alloc->ptr, alloc->size, alloc->birth_ns, alloc->api);
+}
+
+static leak_group_t *sort_groups;
+
+static int compare_groups(const void *a, const void *b) {
+    size_t bytes_a = sort_groups[*(const uint32_t *)a].bytes;
+    size_t bytes_b = sort_groups[*(const uint32_t *)b].bytes;
+    return bytes_a < bytes_b ? 1 : bytes_a > bytes_b ? -1 : 0;
+}
+
+static int alloc_leak_groups(leak_groups_t *leaks, uint32_t stack_count) {
+    leaks->groups = calloc(stack_count, sizeof(leak_group_t));
+    leaks->order = malloc(sizeof(uint32_t) * stack_count);
+    leaks->count = 0;
+    leaks->stack_count = stack_count;
+    if (!leaks->groups || !leaks->order) {
+        free(leaks->groups);
+        free(leaks->order);
+        return -1;
+    }
+    return 0;
+}
+
+// List the stacks with leaked blocks, largest first
+static void order_leak_groups(leak_groups_t *leaks, uint32_t stack_count) {
+    for (uint32_t id = 0; id < stack_count; id++) {
+        if (leaks->groups[id].blocks > 0) {
+            leaks->order[leaks->count++] = id;
+        }
+    }
+    sort_groups = leaks->groups;
+    qsort(leaks->order, leaks->count, sizeof(uint32_t), compare_groups);
+}
+
+// Snapshot live memory grouped by stack, largest first (caller holds all
+// shard locks). In aggregate mode the groups come from the callsite counters.
+static int collect_leaks(leak_groups_t *leaks) {
+    uint32_t stack_count = __atomic_load_n(&stack_table.count, __ATOMIC_ACQUIRE);
+    if (alloc_leak_groups(leaks, stack_count) != 0) return -1;
+
+    if (aggregate_mode) {
+        for (uint32_t id = 0; id < stack_count; id++) {
+            leak_group_t *group = &leaks->groups[id];
+            group->site = *callsite_get(id);
+            group->bytes = group->site.live_bytes;
+            group->blocks = group->site.live_count;
+            group->api = group->site.api;
+        }
+    } else {
+        for_each_allocation(group_leak, leaks);
+    }
+    order_leak_groups(leaks, stack_count);
+    return 0;
+}
+
+// Take suppressed groups out of the listing, adding them to the totals
+// (caller holds symbolizer_lock)
+static void drop_suppressed(leak_groups_t *leaks, size_t *bytes, size_t *blocks) {
+    if (!suppress_rule_count) return;
+    prepare_suppressions();
+
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < leaks->count; i++) {
+        uint32_t id = leaks->order[i];
+        if (suppressed_kinds(id, leaks->groups[id].api)) {
+            *bytes += leaks->groups[id].bytes;
+            *blocks += leaks->groups[id].blocks;
+        } else {
+            leaks->order[kept++] = id;
+        }
+    }
+    leaks->count = kept;
+}
+
+// Print collected groups with symbolized stacks (no shard locks needed),
+// each tagged with label
+static void print_leaks(leak_groups_t *leaks, const char *label) {
+    symbolize_stacks(leaks->order, leaks->count);
+
+    for (uint32_t i = 0; i < leaks->count; i++) {
+        uint32_t id = leaks->order[i];
+        leak_group_t *group = &leaks->groups[id];
+
+        if (aggregate_mode) {
+            fprintf(stderr, "  %s: %zu bytes in %zu blocks from %s (allocated %zu bytes in %zu calls, freed %zu bytes in %zu calls)\n",
+                    label, group->bytes, group->blocks, api_names[group->api], group->site.total_allocated,
+                    group->site.allocation_count, group->site.total_freed, group->site.free_count);
+        } else {
+            time_t first_time = clock_origin_time +
+                                (time_t)((group->first_birth_ns - clock_origin_ns) / 1000000000ull);
+            fprintf(stderr, "  %s: %zu bytes in %zu blocks from %s (first at %p, allocated at %s",
+                    label, group->bytes, group->blocks, api_names[group->api], group->first_ptr,
+                    ctime(&first_time));
+        }
+        print_stack(id);
+    }
+}
+
+// Profile export (MEMTRACK_COLLAPSED, MEMTRACK_PPROF). Every report also
+// writes its per-stack groups, from the callsite counters in aggregate
+// mode, as collapsed stacks for flame graph tools and as a pprof profile
+// (uncompressed protobuf, which pprof reads as is). Both stream through
+// stdio a stack at a time; each address is resolved and each function
+// named once per export.
+
+// A function as exports name it: a symbol, a module without one or an
+// entry point
+typedef struct {
+    const void *key;            // elf_symbol_t, map_range_t or api_names entry
+    char *name;
+    const char *system_name;    // Mangled name, NULL if the same
+    uint64_t id;                // pprof function id, 0 until written
+} export_function_t;
+
+// A return address with its function
+typedef struct {
+    uintptr_t addr;             // 0 for empty
+    uint32_t function;          // Index into the function list
+    uint32_t mapping;           // 1 + map range index, 0 if outside any
+    uint64_t id;                // pprof location id, 0 until written
+} export_frame_t;
+
+typedef struct {
+    FILE *out;
+    export_frame_t *frames;     // Hashed by address
+    size_t frame_capacity;      // Power of two
+    size_t frame_count;
+    export_frame_t entries[API_COUNT];  // Entry point frames, by API
+    export_function_t *functions;
+    size_t function_count;
+    size_t function_room;
+    uint32_t *function_index;   // 1 + function, hashed by key
+    size_t index_capacity;      // Power of two
+    uint64_t next_string;       // pprof string table index
+    uint64_t next_id;
+} exporter_t;
+
+static const char export_unknown = 0;  // Key of the function for frames outside every module
+
+static const char *const export_value_names[EXPORT_VALUE_COUNT] = {
+    "inuse_space", "inuse_objects", "alloc_space", "alloc_objects"
+};
+
+static int exporter_init(exporter_t *exporter, const char *path) {
+    memset(exporter, 0, sizeof(*exporter));
+    for (int api = 0; api < API_COUNT; api++) exporter->entries[api].function = UINT32_MAX;
+    exporter->frame_capacity = 4096;
+    exporter->index_capacity = 1024;
+    exporter->frames = calloc(exporter->frame_capacity, sizeof(export_frame_t));
+    exporter->function_index = calloc(exporter->index_capacity, sizeof(uint32_t));
+    exporter->out = fopen(path, "we");
+    if (!exporter->frames || !exporter->function_index || !exporter->out) {
+        fprintf(stderr, "Memory Tracker: Cannot write profile to %s\n", path);
+        return -1;
+    }
+    setvbuf(exporter->out, NULL, _IOFBF, 1 << 20);
+    return 0;
+}
+
+// Close the output; -1 if anything failed to reach the file
+static int exporter_finish(exporter_t *exporter) {
+    int status = exporter->out ? 0 : -1;
+    if (exporter->out) {
+        if (ferror(exporter->out)) status = -1;
+        if (fclose(exporter->out) != 0) status = -1;
+    }
+    for (size_t i = 0; i < exporter->function_count; i++) {
+        free(exporter->functions[i].name);
+    }
+    free(exporter->functions);
+    free(exporter->function_index);
+    free(exporter->frames);
+    return status;
+}
+
+static uint32_t *export_index_slot(exporter_t *exporter, const void *key) {
+    size_t mask = exporter->index_capacity - 1;
+    size_t i = hash_ptr((uintptr_t)key) & mask;
+    while (exporter->function_index[i] && exporter->functions[exporter->function_index[i] - 1].key != key) {
+        i = (i + 1) & mask;
+    }
+    return &exporter->function_index[i];
+}
+
+static export_frame_t *export_frame_slot(export_frame_t *frames, size_t capacity, uintptr_t addr) {
+    size_t i = hash_ptr(addr) & (capacity - 1);
+    while (frames[i].addr && frames[i].addr != addr) i = (i + 1) & (capacity - 1);
+    return &frames[i];
+}
+
+// Index of the function for key, named on first use (symbol names are
+// demangled); UINT32_MAX if out of memory
+static uint32_t export_function(exporter_t *exporter, const void *key, const char *name, int symbol) {
+    if ((exporter->function_count + 1) * 2 > exporter->index_capacity) {
+        uint32_t *index = calloc(exporter->index_capacity * 2, sizeof(uint32_t));
+        if (!index) return UINT32_MAX;
+        free(exporter->function_index);
+        exporter->function_index = index;
+        exporter->index_capacity *= 2;
+        for (size_t i = 0; i < exporter->function_count; i++) {
+            *export_index_slot(exporter, exporter->functions[i].key) = (uint32_t)i + 1;
+        }
+    }
+
+    uint32_t *slot = export_index_slot(exporter, key);
+    if (*slot) return *slot - 1;
+
+    if (exporter->function_count == exporter->function_room) {
+        size_t room = exporter->function_room ? exporter->function_room * 2 : 1024;
+        export_function_t *functions = realloc(exporter->functions, sizeof(export_function_t) * room);
+        if (!functions) return UINT32_MAX;
+        exporter->functions = functions;
+        exporter->function_room = room;
+    }
+    char *demangled = symbol ? demangle_symbol(name) : NULL;
+    export_function_t *function = &exporter->functions[exporter->function_count];
+    function->key = key;
+    function->name = demangled ? demangled : strdup(name);
+    function->system_name = demangled ? name : NULL;
+    function->id = 0;
+    if (!function->name) return UINT32_MAX;
+    *slot = (uint32_t)++exporter->function_count;
+    return *slot - 1;
+}
+
+// The frame of a return address, resolved on first sight, or with api >= 0
+// the entry point frame named after it; NULL if out of memory (caller
+// holds symbolizer_lock, with the map ranges refreshed)
+static export_frame_t *export_frame(exporter_t *exporter, uintptr_t addr, int api) {
+    if (api >= 0) {
+        export_frame_t *frame = &exporter->entries[api];
+        if (frame->function == UINT32_MAX) {
+            frame->function = export_function(exporter, api_names[api], api_names[api], 0);
+        }
+        return frame->function == UINT32_MAX ? NULL : frame;
+    }
+
+    if ((exporter->frame_count + 1) * 2 > exporter->frame_capacity) {
+        size_t capacity = exporter->frame_capacity * 2;
+        export_frame_t *frames = calloc(capacity, sizeof(export_frame_t));
+        if (!frames) return NULL;
+        for (size_t i = 0; i < exporter->frame_capacity; i++) {
+            if (exporter->frames[i].addr) *export_frame_slot(frames, capacity, exporter->frames[i].addr) = exporter->frames[i];
+        }
+        free(exporter->frames);
+        exporter->frames = frames;
+        exporter->frame_capacity = capacity;
+    }
+
+    export_frame_t *frame = export_frame_slot(exporter->frames, exporter->frame_capacity, addr);
+    if (frame->addr) return frame;
+
+    map_range_t *range = find_map_range(addr);
+    elf_symbol_t *symbol = range && range->module ? find_symbol(range->module, addr - range->bias - 1) : NULL;
+    uint32_t function;
+    if (symbol) {
+        function = export_function(exporter, symbol, symbol->name, 1);
+    } else if (range) {
+        char name[256];
+        const char *base = strrchr(range->path, '/');
+        snprintf(name, sizeof(name), "[%s]", base ? base + 1 : range->path);
+        function = export_function(exporter, range, name, 0);
+    } else {
+        function = export_function(exporter, &export_unknown, "[unknown]", 0);
+    }
+    if (function == UINT32_MAX) return NULL;
+
+    frame->addr = addr;
+    frame->function = function;
+    frame->mapping = range ? (uint32_t)(range - map_ranges) + 1 : 0;
+    exporter->frame_count++;
+    return frame;
+}
+
+static uint64_t export_value(const leak_group_t *group, int value) {
+    switch (value) {
+    case EXPORT_INUSE_OBJECTS: return group->blocks;
+    case EXPORT_ALLOC_SPACE: return group->site.total_allocated;
+    case EXPORT_ALLOC_OBJECTS: return group->site.allocation_count;
+    default: return group->bytes;
+    }
+}
+
+// One line per stack, outermost frame first: "main;parse;malloc 4096".
+// Captured stacks start at the caller; the entry point is added as the leaf.
+static void export_collapsed(exporter_t *exporter, leak_groups_t *leaks) {
+    for (uint32_t id = 0; id < leaks->stack_count; id++) {
+        leak_group_t *group = &leaks->groups[id];
+        uint64_t value = export_value(group, collapsed_value);
+        if (!value) continue;
+
+        if (id == 0) {
+            fputs("[no stack]", exporter->out);
+        } else {
+            stack_trace_t *trace = stack_trace_get(id);
+            for (uint32_t j = trace->depth; j-- > 0;) {
+                export_frame_t *frame = export_frame(exporter, (uintptr_t)trace->frames[j], -1);
+                fputs(frame ? exporter->functions[frame->function].name : "[unknown]", exporter->out);
+                if (j > 0 || group->api >= 0) fputc(';', exporter->out);
+            }
+            if (group->api >= 0) {
+                export_frame_t *frame = export_frame(exporter, 0, group->api);
+                fputs(frame ? exporter->functions[frame->function].name : "[unknown]", exporter->out);
+            }
+        }
+        fprintf(exporter->out, " %llu\n", (unsigned long long)value);
+    }
+}
+
+// Protocol buffer encoding, just what profile.proto needs
+static size_t pb_varint_size(uint64_t value) {
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+static void pb_varint(FILE *out, uint64_t value) {
+    while (value >= 0x80) {
+        putc_unlocked((int)(value & 0x7f) | 0x80, out);
+        value >>= 7;
+    }
+    putc_unlocked((int)value, out);
+}
+
+// Size of a varint field
+static size_t pb_field_size(uint32_t field, uint64_t value) {
+    return pb_varint_size(field << 3) + pb_varint_size(value);
+}
+
+static void pb_field(FILE *out, uint32_t field, uint64_t value) {
+    pb_varint(out, field << 3);
+    pb_varint(out, value);
+}
+
+// Header of a length-delimited field
+static void pb_message(FILE *out, uint32_t field, size_t size) {
+    pb_varint(out, field << 3 | 2);
+    pb_varint(out, size);
+}
+
+// Append to the string table and return the string's index
+static uint64_t pprof_string(exporter_t *exporter, const char *text) {
+    size_t length = strlen(text);
+    pb_message(exporter->out, 6, length);
+    fwrite(text, 1, length, exporter->out);
+    return exporter->next_string++;
+}
+
+static void pprof_value_type(exporter_t *exporter, uint32_t field, const char *type, const char *unit) {
+    uint64_t type_index = pprof_string(exporter, type);
+    uint64_t unit_index = pprof_string(exporter, unit);
+    pb_message(exporter->out, field, pb_field_size(1, type_index) + pb_field_size(2, unit_index));
+    pb_field(exporter->out, 1, type_index);
+    pb_field(exporter->out, 2, unit_index);
+}
+
+// Location id of a frame, writing it (and its function) on first use
+static uint64_t pprof_location(exporter_t *exporter, export_frame_t *frame) {
+    if (frame->id) return frame->id;
+
+    export_function_t *function = &exporter->functions[frame->function];
+    if (!function->id) {
+        uint64_t name = pprof_string(exporter, function->name);
+        uint64_t system_name = function->system_name ? pprof_string(exporter, function->system_name) : name;
+        function->id = ++exporter->next_id;
+        pb_message(exporter->out, 5, pb_field_size(1, function->id) + pb_field_size(2, name) +
+                                     pb_field_size(3, system_name));
+        pb_field(exporter->out, 1, function->id);
+        pb_field(exporter->out, 2, name);
+        pb_field(exporter->out, 3, system_name);
+    }
+
+    frame->id = ++exporter->next_id;
+    size_t line = pb_field_size(1, function->id);
+    size_t size = pb_field_size(1, frame->id) + pb_field_size(3, frame->addr) +
+                  pb_varint_size(4 << 3 | 2) + pb_varint_size(line) + line;
+    if (frame->mapping) size += pb_field_size(2, frame->mapping);
+    pb_message(exporter->out, 4, size);
+    pb_field(exporter->out, 1, frame->id);
+    if (frame->mapping) pb_field(exporter->out, 2, frame->mapping);
+    pb_field(exporter->out, 3, frame->addr);
+    pb_message(exporter->out, 4, line);
+    pb_field(exporter->out, 1, function->id);
+    return frame->id;
+}
+
+// A pprof heap profile: in-use objects and bytes per stack, plus the
+// allocation totals in aggregate mode. Locations are leaf first.
+static void export_pprof(exporter_t *exporter, leak_groups_t *leaks) {
+    static const int aggregate_values[] = {
+        EXPORT_ALLOC_OBJECTS, EXPORT_ALLOC_SPACE, EXPORT_INUSE_OBJECTS, EXPORT_INUSE_SPACE
+    };
+    const int *values = aggregate_mode ? aggregate_values : aggregate_values + 2;
+    size_t value_count = aggregate_mode ? 4 : 2;
+    FILE *out = exporter->out;
+
+    pprof_string(exporter, "");
+    uint64_t default_type = 0;
+    for (size_t v = 0; v < value_count; v++) {
+        int space = values[v] == EXPORT_ALLOC_SPACE || values[v] == EXPORT_INUSE_SPACE;
+        if (values[v] == EXPORT_INUSE_SPACE) default_type = exporter->next_string;
+        pprof_value_type(exporter, 1, export_value_names[values[v]], space ? "bytes" : "count");
+    }
+    pb_field(out, 14, default_type);
+    pprof_value_type(exporter, 11, "space", "bytes");
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    pb_field(out, 9, (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec);
+
+    for (size_t i = 0; i < map_range_count; i++) {
+        map_range_t *range = &map_ranges[i];
+        uint64_t filename = pprof_string(exporter, range->path);
+        size_t size = pb_field_size(1, i + 1) + pb_field_size(2, range->start) + pb_field_size(3, range->end) +
+                      pb_field_size(4, range->offset) + pb_field_size(5, filename) + pb_field_size(7, 1);
+        pb_message(out, 3, size);
+        pb_field(out, 1, i + 1);
+        pb_field(out, 2, range->start);
+        pb_field(out, 3, range->end);
+        pb_field(out, 4, range->offset);
+        pb_field(out, 5, filename);
+        pb_field(out, 7, 1);
+    }
+
+    uint64_t locations[MAX_BACKTRACE + 1];
+    for (uint32_t id = 0; id < leaks->stack_count; id++) {
+        leak_group_t *group = &leaks->groups[id];
+        uint64_t sample[4];
+        int any = 0;
+        for (size_t v = 0; v < value_count; v++) {
+            sample[v] = export_value(group, values[v]);
+            any |= sample[v] != 0;
+        }
+        if (!any) continue;
+
+        uint32_t count = 0;
+        if (id != 0) {
+            stack_trace_t *trace = stack_trace_get(id);
+            export_frame_t *frame = group->api >= 0 ? export_frame(exporter, 0, group->api) : NULL;
+            if (frame) locations[count++] = pprof_location(exporter, frame);
+            for (uint32_t j = 0; j < trace->depth; j++) {
+                frame = export_frame(exporter, (uintptr_t)trace->frames[j], -1);
+                if (frame) locations[count++] = pprof_location(exporter, frame);
+            }
+        }
+
+        size_t location_bytes = 0, value_bytes = 0;
+        for (uint32_t i = 0; i < count; i++) location_bytes += pb_varint_size(locations[i]);
+        for (size_t v = 0; v < value_count; v++) value_bytes += pb_varint_size(sample[v]);
+        size_t size = pb_varint_size(2 << 3 | 2) + pb_varint_size(value_bytes) + value_bytes;
+        if (count) size += pb_varint_size(1 << 3 | 2) + pb_varint_size(location_bytes) + location_bytes;
+
+        pb_message(out, 2, size);
+        if (count) {
+            pb_message(out, 1, location_bytes);
+            for (uint32_t i = 0; i < count; i++) pb_varint(out, locations[i]);
+        }
+        pb_message(out, 2, value_bytes);
+        for (size_t v = 0; v < value_count; v++) pb_varint(out, sample[v]);
+    }
+}
+
+// Write the configured exports of a report's groups (caller holds
+// symbolizer_lock)
+static void export_profiles(leak_groups_t *leaks) {
+    refresh_map_ranges();
+
+    if (collapsed_path[0]) {
+        exporter_t exporter;
+        if (exporter_init(&exporter, collapsed_path) == 0) export_collapsed(&exporter, leaks);
+        if (exporter_finish(&exporter) == 0) {
+            fprintf(stderr, "Memory Tracker: Wrote collapsed stacks (%s) to %s\n",
+                    export_value_names[collapsed_value], collapsed_path);
+        }
+    }
+    if (pprof_path[0]) {
+        exporter_t exporter;
+        if (exporter_init(&exporter, pprof_path) == 0) export_pprof(&exporter, leaks);
+        if (exporter_finish(&exporter) == 0) {
+            fprintf(stderr, "Memory Tracker: Wrote pprof heap profile to %s\n", pprof_path);
+        }
+    }
+}
+
+// Reachability (MEMTRACK_REACHABILITY), after memcheck's leak checker. The
+// live table is copied into an address-ordered view, then every aligned
+// word of the roots (writable module segments, registered thread stacks and
+// static TLS, the reporting thread's registers) is looked up in it. A block
+// reached through start pointers all the way is still reachable; one only
+// reached through an interior pointer somewhere on the way is possibly
+// lost. Of the blocks never reached, those that only other unreached
+// blocks point to are indirectly lost and the rest definitely lost.
+// Memory is read through process_vm_readv, so a block that a running
+// thread frees and unmaps mid-scan is skipped instead of faulting.
+//
+// Big heaps are scanned by a pool of worker threads. The copy, the
+// address-ordered view and its page map are built in parallel slices;
+// marking runs with a work-stealing deque per worker over a shared mark
+// bitmap. Splitting the unreached blocks into cliques is sequential.
+
+// Chase-Lev work-stealing deque: the owner pushes and pops at bottom,
+// thieves take from top
+typedef struct {
+    long top;
+    long bottom;
+    size_t *items;              // REACH_DEQUE_SIZE entries
+} reach_deque_t;
+
+typedef struct reach reach_t;
+
+// One scanning thread (worker 0 is the reporting thread)
+typedef struct {
+    reach_t *reach;
+    unsigned int index;
+    pthread_t thread;
+    reach_deque_t deque;
+    uint64_t rng;               // Picks steal victims
+    char *buffer;               // Batched regions are read back to back into this
+    struct iovec batch[REACH_BATCH];
+    uint8_t sources[REACH_BATCH];
+    size_t batch_count;
+    size_t batch_bytes;
+} reach_worker_t;
+
+// Slice of a live table for the parallel copy
+typedef struct {
+    slot_table_t *table;
+    size_t begin;
+    size_t end;
+    size_t offset;              // Where its blocks go in the copy
+} reach_task_t;
+
+// Region hash entry: region number + 1 (0 for empty), and the region's
+// position in address order
+typedef struct {
+    uintptr_t key;
+    uint32_t id;
+} reach_region_t;
+
+struct reach {
+    reach_block_t *blocks;      // Sorted by start
+    reach_block_t *unsorted;    // As copied from the tables
+    size_t count;
+    uintptr_t low;              // Span of all blocks
+    uintptr_t high;
+    uint64_t *marks;            // Mark bitmap: two bits per sorted block, 1 possibly lost, 2 reachable
+    reach_region_t *regions;    // Hash of the regions blocks cover
+    uint32_t region_count;
+    uint32_t *first;            // Page map: per page of each region in address order, the first block starting at or after it
+    uint32_t *cursor;           // Scatter position per page while sorting
+    size_t page_count;
+    reach_task_t *tasks;
+    size_t task_count;
+    size_t next_task;           // Next task index to hand out
+    size_t *overflow;           // Marked blocks that did not fit in a deque
+    size_t overflow_count;
+    pthread_mutex_t overflow_lock;
+    reach_worker_t *workers;
+    unsigned int worker_count;
+    unsigned int idle;          // Workers that found nothing to do
+    void (*phase)(reach_worker_t *worker);  // What the pool runs next; NULL stops it
+    pthread_mutex_t pool_lock;
+    pthread_cond_t pool_wake;
+    unsigned int arrived;
+    unsigned int generation;
+    int leak_phase;             // Splitting the unreached blocks
+    size_t leader;              // Leak phase: block whose clique is being traced
+    pid_t pid;
+    size_t tls_bytes;           // Static TLS below each thread pointer
+    size_t tcb_bytes;           // Thread descriptor at the thread pointer
+};
+
+static void *reach_map(size_t size) {
+    void *memory = mmap(NULL, size ? size : 1, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return memory == MAP_FAILED ? NULL : memory;
+}
+
+static void reach_unmap(void *memory, size_t size) {
+    if (memory) munmap(memory, size ? size : 1);
+}
+
+// Every worker waits here until all have arrived
+static void reach_barrier(reach_t *reach) {
+    pthread_mutex_lock(&reach->pool_lock);
+    unsigned int generation = reach->generation;
+    if (++reach->arrived == reach->worker_count) {
+        reach->arrived = 0;
+        reach->generation++;
+        pthread_cond_broadcast(&reach->pool_wake);
+    } else {
+        while (generation == reach->generation) {
+            pthread_cond_wait(&reach->pool_wake, &reach->pool_lock);
+        }
+    }
+    pthread_mutex_unlock(&reach->pool_lock);
+}
+
+static void *reach_worker_main(void *arg) {
+    reach_worker_t *worker = arg;
+    reach_t *reach = worker->reach;
+    in_tracker = 1;
+
+    for (;;) {
+        reach_barrier(reach);
+        void (*phase)(reach_worker_t *) = reach->phase;
+        if (!phase) return NULL;
+        phase(worker);
+        reach_barrier(reach);
+    }
+}
+
+// Run phase on every worker and wait for all of them
+static void reach_run(reach_t *reach, void (*phase)(reach_worker_t *worker)) {
+    reach->phase = phase;
+    reach->next_task = 0;
+    reach->idle = 0;
+    reach_barrier(reach);
+    phase(&reach->workers[0]);
+    reach_barrier(reach);
+}
+
+// Next of count shared tasks, or count when they are all taken
+static size_t reach_next_task(reach_t *reach, size_t count) {
+    size_t task = __atomic_fetch_add(&reach->next_task, 1, __ATOMIC_RELAXED);
+    return task < count ? task : count;
+}
+
+// This worker's share of the copied blocks
+static void reach_slice(reach_worker_t *worker, size_t *begin, size_t *end) {
+    reach_t *reach = worker->reach;
+    *begin = reach->count * worker->index / reach->worker_count;
+    *end = reach->count * (worker->index + 1) / reach->worker_count;
+}
+
+// Start the pool: one worker per online CPU once there are enough blocks,
+// or as many as MEMTRACK_REACH_THREADS asks for
+static int reach_start_workers(reach_t *reach) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    char *env = getenv("MEMTRACK_REACH_THREADS");
+    if (env && *env) {
+        count = strtol(env, NULL, 10);
+    } else if (reach->count < REACH_PARALLEL_BLOCKS) {
+        count = 1;
+    }
+    if (count > REACH_MAX_WORKERS) count = REACH_MAX_WORKERS;
+    if (count < 1) count = 1;
+
+    reach->workers = reach_map(sizeof(reach_worker_t) * REACH_MAX_WORKERS);
+    if (!reach->workers) return -1;
+    for (long i = 0; i < count; i++) {
+        reach_worker_t *worker = &reach->workers[i];
+        worker->reach = reach;
+        worker->index = (unsigned int)i;
+        worker->rng = 0x9E3779B97F4A7C15ull * (uint64_t)(i + 1);
+        worker->buffer = reach_map(REACH_BUFFER_BYTES);
+        worker->deque.items = reach_map(sizeof(size_t) * REACH_DEQUE_SIZE);
+        if (!worker->buffer || !worker->deque.items) {
+            reach_unmap(worker->buffer, REACH_BUFFER_BYTES);
+            reach_unmap(worker->deque.items, sizeof(size_t) * REACH_DEQUE_SIZE);
+            worker->buffer = NULL;
+            worker->deque.items = NULL;
+            if (i == 0) return -1;
+            count = i;
+            break;
+        }
+    }
+
+    // Workers that could not be started are dropped before anyone passes
+    // the first barrier
+    pthread_mutex_init(&reach->pool_lock, NULL);
+    pthread_cond_init(&reach->pool_wake, NULL);
+    pthread_mutex_init(&reach->overflow_lock, NULL);
+    reach->worker_count = (unsigned int)count;
+    for (long i = 1; i < count; i++) {
+        if (pthread_create(&reach->workers[i].thread, NULL, reach_worker_main, &reach->workers[i]) != 0) {
+            pthread_mutex_lock(&reach->pool_lock);
+            for (long j = i; j < count; j++) {
+                reach_unmap(reach->workers[j].buffer, REACH_BUFFER_BYTES);
+                reach_unmap(reach->workers[j].deque.items, sizeof(size_t) * REACH_DEQUE_SIZE);
+            }
+            reach->worker_count = (unsigned int)i;
+            pthread_mutex_unlock(&reach->pool_lock);
+            break;
+        }
+    }
+    return 0;
+}
+
+// Send the other workers home, leaving the reporting thread's
+static void reach_stop_workers(reach_t *reach) {
+    if (reach->worker_count <= 1) return;
+
+    reach->phase = NULL;
+    reach_barrier(reach);
+    for (unsigned int i = 1; i < reach->worker_count; i++) {
+        pthread_join(reach->workers[i].thread, NULL);
+        reach_unmap(reach->workers[i].buffer, REACH_BUFFER_BYTES);
+        reach_unmap(reach->workers[i].deque.items, sizeof(size_t) * REACH_DEQUE_SIZE);
+    }
+    reach->worker_count = 1;
+}
+
+static void reach_release(reach_t *reach) {
+    reach_stop_workers(reach);
+    if (reach->worker_count) {
+        reach_unmap(reach->workers[0].buffer, REACH_BUFFER_BYTES);
+        reach_unmap(reach->workers[0].deque.items, sizeof(size_t) * REACH_DEQUE_SIZE);
+    }
+    reach_unmap(reach->workers, sizeof(reach_worker_t) * REACH_MAX_WORKERS);
+    reach_unmap(reach->blocks, sizeof(reach_block_t) * reach->count);
+    reach_unmap(reach->unsorted, sizeof(reach_block_t) * reach->count);
+    reach_unmap(reach->marks, sizeof(uint64_t) * (reach->count / 32 + 1));
+    reach_unmap(reach->regions, sizeof(reach_region_t) * REACH_REGION_SLOTS);
+    reach_unmap(reach->first, sizeof(uint32_t) * (reach->page_count + 1));
+    reach_unmap(reach->cursor, sizeof(uint32_t) * (reach->page_count + 1));
+    reach_unmap(reach->overflow, sizeof(size_t) * (2 * reach->count + 1));
+    free(reach->tasks);
+}
+
+// Count or copy the live blocks of one table slice
+static size_t reach_copy_slice(const reach_task_t *task, reach_block_t *blocks) {
+    size_t count = 0;
+
+    for (size_t i = task->begin; i < task->end; i++) {
+        const table_slot_t *slot = &task->table->slots[i];
+        if (slot->ptr == SLOT_EMPTY || slot->ptr == SLOT_TOMBSTONE) continue;
+        if (!blocks) {
+            count++;
+            continue;
+        }
+
+        reach_block_t *block = &blocks[count++];
+        block->start = slot->ptr;
+        block->state = REACH_UNSEEN;
+        if (aggregate_mode) {
+            block->size = slot->block >> BLOCK_SIZE_SHIFT;
+            block->birth_ns = 0;
+            block->stack_id = (uint32_t)(slot->block & ((1u << BLOCK_ID_BITS) - 1));
+            block->api = (uint8_t)((slot->block >> BLOCK_ID_BITS) & ((1u << BLOCK_API_BITS) - 1));
+        } else {
+            block->size = slot->alloc->size;
+            block->birth_ns = slot->alloc->birth_ns;
+            block->stack_id = slot->alloc->stack_id;
+            block->api = slot->alloc->api;
+        }
+    }
+    return count;
+}
+
+static void reach_phase_count(reach_worker_t *worker) {
+    reach_t *reach = worker->reach;
+    size_t task;
+    while ((task = reach_next_task(reach, reach->task_count)) < reach->task_count) {
+        reach->tasks[task].offset = reach_copy_slice(&reach->tasks[task], NULL);
+    }
+}
+
+static void reach_phase_copy(reach_worker_t *worker) {
+    reach_t *reach = worker->reach;
+    size_t task;
+    while ((task = reach_next_task(reach, reach->task_count)) < reach->task_count) {
+        reach_copy_slice(&reach->tasks[task], reach->unsorted + reach->tasks[task].offset);
+    }
+}
+
+// Split every live table into slices
+static int reach_plan_copy(reach_t *reach) {
+    size_t count = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        for (unsigned int s = 0; s < tracker.shard_count; s++) {
+            slot_table_t *tables[2] = { &tracker.shards[s].table, &tracker.shards[s].old_table };
+            for (int t = 0; t < 2; t++) {
+                for (size_t begin = 0; begin < tables[t]->capacity; begin += REACH_COPY_SLICE) {
+                    if (pass == 1) {
+                        reach_task_t *task = &reach->tasks[reach->task_count++];
+                        task->table = tables[t];
+                        task->begin = begin;
+                        task->end = begin + REACH_COPY_SLICE < tables[t]->capacity ?
+                                    begin + REACH_COPY_SLICE : tables[t]->capacity;
+                    } else {
+                        count++;
+                    }
+                }
+            }
+        }
+        if (pass == 0) {
+            reach->tasks = malloc(sizeof(reach_task_t) * (count ? count : 1));
+            if (!reach->tasks) return -1;
+        }
+    }
+    return 0;
+}
+
+// Snapshot the live blocks for a scan (caller holds all shard locks).
+// Fails if process_vm_readv is not permitted here.
+static int reach_collect(reach_t *reach) {
+    memset(reach, 0, sizeof(*reach));
+    reach->pid = getpid();
+
+    uintptr_t probe = 0, copy;
+    struct iovec local = { &copy, sizeof(copy) };
+    struct iovec remote = { &probe, sizeof(probe) };
+    if (process_vm_readv(reach->pid, &local, 1, &remote, 1, 0) != sizeof(copy)) return -1;
+    if (reach_plan_copy(reach) != 0) return -1;
+
+    // Workers are sized by the table capacity here, the block count later
+    for (unsigned int s = 0; s < tracker.shard_count; s++) {
+        reach->count += tracker.shards[s].table.count + tracker.shards[s].old_table.count;
+    }
+    if (reach_start_workers(reach) != 0) {
+        reach_release(reach);
+        return -1;
+    }
+
+    reach_run(reach, reach_phase_count);
+    size_t count = 0;
+    for (size_t t = 0; t < reach->task_count; t++) {
+        size_t blocks = reach->tasks[t].offset;
+        reach->tasks[t].offset = count;
+        count += blocks;
+    }
+    reach->count = count;
+
+    reach->unsorted = reach_map(sizeof(reach_block_t) * count);
+    reach->blocks = reach_map(sizeof(reach_block_t) * count);
+    reach->marks = reach_map(sizeof(uint64_t) * (count / 32 + 1));
+    reach->regions = reach_map(sizeof(reach_region_t) * REACH_REGION_SLOTS);
+    reach->overflow = reach_map(sizeof(size_t) * (2 * count + 1));
+    if (count > UINT32_MAX || !reach->unsorted || !reach->blocks || !reach->marks ||
+        !reach->regions || !reach->overflow) {
+        reach_release(reach);
+        return -1;
+    }
+
+    reach_run(reach, reach_phase_copy);
+    return 0;
+}
+
+static uint64_t reach_region_hash(uintptr_t region) {
+    return hash_ptr(region + 1) & (REACH_REGION_SLOTS - 1);
+}
+
+// Add a region to the hash; concurrent inserts of the same one agree
+static void reach_region_add(reach_t *reach, uintptr_t region) {
+    for (uint64_t i = reach_region_hash(region); ; i = (i + 1) & (REACH_REGION_SLOTS - 1)) {
+        uintptr_t key = __atomic_load_n(&reach->regions[i].key, __ATOMIC_RELAXED);
+        if (key == region + 1) return;
+        if (key == 0) {
+            if (__atomic_compare_exchange_n(&reach->regions[i].key, &key, region + 1, 0,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED) ||
+                key == region + 1) {
+                return;
+            }
+        }
+    }
+}
+
+static const reach_region_t *reach_region_find(const reach_t *reach, uintptr_t region) {
+    for (uint64_t i = reach_region_hash(region); ; i = (i + 1) & (REACH_REGION_SLOTS - 1)) {
+        const reach_region_t *entry = &reach->regions[i];
+        if (entry->key == region + 1) return entry;
+        if (entry->key == 0) return NULL;
+    }
+}
+
+// Page map index of addr, which lies in a known region
+static size_t reach_page(const reach_t *reach, uintptr_t addr) {
+    const reach_region_t *region = reach_region_find(reach, addr >> REACH_REGION_SHIFT);
+    return (size_t)region->id * REACH_REGION_PAGES +
+           ((addr >> REACH_PAGE_SHIFT) & (REACH_REGION_PAGES - 1));
+}
+
+// Every region a block covers goes in the hash, so interior pointers into
+// big blocks resolve too
+static void reach_phase_regions(reach_worker_t *worker) {
+    reach_t *reach = worker->reach;
+    size_t begin, end;
+    reach_slice(worker, &begin, &end);
+
+    uintptr_t last = UINTPTR_MAX;
+    for (size_t i = begin; i < end; i++) {
+        const reach_block_t *block = &reach->unsorted[i];
+        uintptr_t first = block->start >> REACH_REGION_SHIFT;
+        uintptr_t final = (block->start + (block->size ? block->size - 1 : 0)) >> REACH_REGION_SHIFT;
+        for (uintptr_t region = first; region <= final; region++) {
+            if (region != last) reach_region_add(reach, region);
+            last = region;
+        }
+    }
+}
+
+static void reach_phase_histogram(reach_worker_t *worker) {
+    reach_t *reach = worker->reach;
+    size_t begin, end;
+    reach_slice(worker, &begin, &end);
+
+    for (size_t i = begin; i < end; i++) {
+        __atomic_add_fetch(&reach->cursor[reach_page(reach, reach->unsorted[i].start)], 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void reach_phase_scatter(reach_worker_t *worker) {
+    reach_t *reach = worker->reach;
+    size_t begin, end;
+    reach_slice(worker, &begin, &end);
+
+    for (size_t i = begin; i < end; i++) {
+        size_t page = reach_page(reach, reach->unsorted[i].start);
+        reach->blocks[__atomic_fetch_add(&reach->cursor[page], 1, __ATOMIC_RELAXED)] = reach->unsorted[i];
+    }
+}
+
+static int compare_reach_blocks(const void *a, const void *b) {
+    uintptr_t start_a = ((const reach_block_t *)a)->start;
+    uintptr_t start_b = ((const reach_block_t *)b)->start;
+    return start_a < start_b ? -1 : start_a > start_b;
+}
+
+// Order the few blocks that start in each page
+static void reach_phase_sort_pages(reach_worker_t *worker) {
+    reach_t *reach = worker->reach;
+    size_t tasks = (reach->page_count + REACH_SORT_PAGES - 1) / REACH_SORT_PAGES;
+    size_t task;
+
+    while ((task = reach_next_task(reach, tasks)) < tasks) {
+        size_t end = (task + 1) * REACH_SORT_PAGES;
+        if (end > reach->page_count) end = reach->page_count;
+        for (size_t page = task * REACH_SORT_PAGES; page < end; page++) {
+            size_t count = reach->first[page + 1] - reach->first[page];
+            if (count > 1) {
+                qsort(reach->blocks + reach->first[page], count, sizeof(reach_block_t), compare_reach_blocks);
+            }
+        }
+    }
+}
+
+static int compare_region_keys(const void *a, const void *b) {
+    uintptr_t key_a = ((const reach_region_t *)a)->key;
+    uintptr_t key_b = ((const reach_region_t *)b)->key;
+    return key_a < key_b ? -1 : key_a > key_b;
+}
+
+// Build the address-ordered view without a global sort: number the
+// regions blocks cover in address order, count the blocks starting in each
+// of their pages, scatter the blocks by page and sort within pages. The
+// counts' prefix sums are the page map used to resolve pointers.
+static int reach_index(reach_t *reach) {
+    reach_run(reach, reach_phase_regions);
+
+    // Each entry's id holds its hash slot while the copies are sorted
+    uint32_t count = 0;
+    reach_region_t *order = reach_map(sizeof(reach_region_t) * REACH_REGION_SLOTS);
+    if (!order) return -1;
+    for (uint32_t i = 0; i < REACH_REGION_SLOTS; i++) {
+        if (!reach->regions[i].key) continue;
+        order[count].key = reach->regions[i].key;
+        order[count++].id = i;
+    }
+    qsort(order, count, sizeof(reach_region_t), compare_region_keys);
+    for (uint32_t id = 0; id < count; id++) {
+        reach->regions[order[id].id].id = id;
+    }
+    reach_unmap(order, sizeof(reach_region_t) * REACH_REGION_SLOTS);
+
+    reach->region_count = count;
+    reach->page_count = (size_t)count * REACH_REGION_PAGES;
+    reach->first = reach_map(sizeof(uint32_t) * (reach->page_count + 1));
+    reach->cursor = reach_map(sizeof(uint32_t) * (reach->page_count + 1));
+    if (!reach->first || !reach->cursor) return -1;
+
+    reach_run(reach, reach_phase_histogram);
+    uint32_t offset = 0;
+    for (size_t page = 0; page < reach->page_count; page++) {
+        uint32_t blocks = reach->cursor[page];
+        reach->first[page] = reach->cursor[page] = offset;
+        offset += blocks;
+    }
+    reach->first[reach->page_count] = offset;
+
+    reach_run(reach, reach_phase_scatter);
+    reach_run(reach, reach_phase_sort_pages);
+    reach_unmap(reach->unsorted, sizeof(reach_block_t) * reach->count);
+    reach_unmap(reach->cursor, sizeof(uint32_t) * (reach->page_count + 1));
+    reach->unsorted = NULL;
+    reach->cursor = NULL;
+
+    if (reach->count) {
+        reach_block_t *last = &reach->blocks[reach->count - 1];
+        reach->low = reach->blocks[0].start;
+        reach->high = last->start + (last->size ? last->size : 1);
+    }
+    return 0;
+}
+
+// Block containing addr, or -1: the page map narrows the search to the
+// blocks starting in addr's page, or the last one before it
+static long reach_find(const reach_t *reach, uintptr_t addr) {
+    const reach_region_t *region = reach_region_find(reach, addr >> REACH_REGION_SHIFT);
+    if (!region) return -1;
+
+    size_t page = (size_t)region->id * REACH_REGION_PAGES +
+                  ((addr >> REACH_PAGE_SHIFT) & (REACH_REGION_PAGES - 1));
+    size_t low = reach->first[page], high = reach->first[page + 1];
+
+    // First block starting above addr
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (reach->blocks[mid].start <= addr) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low == 0) return -1;
+
+    const reach_block_t *block = &reach->blocks[low - 1];
+    return addr - block->start < (block->size ? block->size : 1) ? (long)(low - 1) : -1;
+}
+
+// Raise block i's mark to class (REACH_POSSIBLE or REACH_REACHABLE);
+// true for the one worker whose update raised it
+static int reach_raise(reach_t *reach, size_t i, int class) {
+    uint64_t *word = &reach->marks[i / 32];
+    unsigned int shift = (unsigned int)(i % 32) * 2;
+    uint64_t bits = class == REACH_REACHABLE ? 2 : 1;
+    uint64_t old = __atomic_load_n(word, __ATOMIC_RELAXED);
+
+    do {
+        if (((old >> shift) & 3) >= bits) return 0;
+    } while (!__atomic_compare_exchange_n(word, &old, (old & ~(3ull << shift)) | bits << shift, 1,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return 1;
+}
+
+static int reach_marked(reach_t *reach, size_t i) {
+    uint64_t bits = (__atomic_load_n(&reach->marks[i / 32], __ATOMIC_RELAXED) >> (i % 32) * 2) & 3;
+    return bits == 2 ? REACH_REACHABLE : bits == 1 ? REACH_POSSIBLE : REACH_UNSEEN;
+}
+
+static int reach_deque_push(reach_deque_t *deque, size_t item) {
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    if (bottom - top >= REACH_DEQUE_SIZE) return 0;
+
+    __atomic_store_n(&deque->items[bottom & (REACH_DEQUE_SIZE - 1)], item, __ATOMIC_RELAXED);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static int reach_deque_pop(reach_deque_t *deque, size_t *item) {
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+    if (top > bottom) {
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    *item = __atomic_load_n(&deque->items[bottom & (REACH_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+    if (top == bottom) {
+        // Last item: race the thieves for it
+        int won = __atomic_compare_exchange_n(&deque->top, &top, top + 1, 0,
+                                              __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return won;
+    }
+    return 1;
+}
+
+static int reach_deque_steal(reach_deque_t *deque, size_t *item) {
+    long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom) return 0;
+
+    *item = __atomic_load_n(&deque->items[top & (REACH_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+    return __atomic_compare_exchange_n(&deque->top, &top, top + 1, 0,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+static int reach_deque_empty(reach_deque_t *deque) {
+    return __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE) >=
+           __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+}
+
+// Queue block i for scanning; the shared overflow stack takes what the
+// worker's deque cannot
+static void reach_push(reach_worker_t *worker, size_t i) {
+    if (reach_deque_push(&worker->deque, i)) return;
+
+    reach_t *reach = worker->reach;
+    pthread_mutex_lock(&reach->overflow_lock);
+    reach->overflow[reach->overflow_count++] = i;
+    pthread_mutex_unlock(&reach->overflow_lock);
+}
+
+// Next block for this worker: its own deque, else a batch off the overflow
+// stack
+static int reach_pop(reach_worker_t *worker, size_t *i) {
+    if (reach_deque_pop(&worker->deque, i)) return 1;
+
+    reach_t *reach = worker->reach;
+    if (!__atomic_load_n(&reach->overflow_count, __ATOMIC_RELAXED)) return 0;
+    pthread_mutex_lock(&reach->overflow_lock);
+    size_t moved = 0;
+    while (reach->overflow_count && moved < REACH_DEQUE_SIZE / 2 &&
+           reach_deque_push(&worker->deque, reach->overflow[reach->overflow_count - 1])) {
+        reach->overflow_count--;
+        moved++;
+    }
+    pthread_mutex_unlock(&reach->overflow_lock);
+    return moved && reach_deque_pop(&worker->deque, i);
+}
+
+// A word that may point into a block, found in a region whose own class is
+// source
+static void reach_visit(reach_worker_t *worker, uintptr_t value, int source) {
+    reach_t *reach = worker->reach;
+    long i = reach_find(reach, value);
+    if (i < 0) return;
+    reach_block_t *block = &reach->blocks[i];
+
+    if (reach->leak_phase) {
+        // An earlier clique's leader becomes part of this clique
+        if (block->state == REACH_UNSEEN) {
+            block->state = REACH_INDIRECT;
+            reach_push(worker, (size_t)i);
+        } else if (block->state == REACH_DEFINITE && (size_t)i != reach->leader) {
+            block->state = REACH_INDIRECT;
+        }
+        return;
+    }
+
+    if (reach_raise(reach, (size_t)i, value == block->start ? source : REACH_POSSIBLE)) {
+        reach_push(worker, (size_t)i);
+    }
+}
+
+static void reach_scan_words(reach_worker_t *worker, const char *data, size_t length, int source) {
+    reach_t *reach = worker->reach;
+    const uintptr_t *words = (const uintptr_t *)data;
+    size_t count = length / sizeof(uintptr_t);
+
+    for (size_t i = 0; i < count; i++) {
+        uintptr_t value = words[i];
+        if (value >= reach->low && value < reach->high) {
+            reach_visit(worker, value, source);
+        }
+    }
+}
+
+// Read the batched regions and scan them. process_vm_readv stops at the
+// first region it cannot read; that one is skipped and the rest retried.
+static void reach_flush(reach_worker_t *worker) {
+    size_t done = 0;
+
+    while (done < worker->batch_count) {
+        struct iovec local = { worker->buffer, REACH_BUFFER_BYTES };
+        ssize_t got = process_vm_readv(worker->reach->pid, &local, 1, &worker->batch[done],
+                                       worker->batch_count - done, 0);
+        size_t left = got > 0 ? (size_t)got : 0;
+        const char *data = worker->buffer;
+
+        while (done < worker->batch_count && left >= worker->batch[done].iov_len) {
+            size_t length = worker->batch[done].iov_len;
+            reach_scan_words(worker, data, length, worker->sources[done]);
+            data += length;
+            left -= length;
+            done++;
+        }
+        if (done < worker->batch_count) done++;
+    }
+    worker->batch_count = 0;
+    worker->batch_bytes = 0;
+}
+
+// Queue the aligned words of [addr, addr + length) for scanning
+static void reach_add(reach_worker_t *worker, uintptr_t addr, size_t length, int source) {
+    uintptr_t mask = sizeof(uintptr_t) - 1;
+    uintptr_t start = (addr + mask) & ~mask;
+    uintptr_t end = (addr + length) & ~mask;
+
+    while (start < end) {
+        size_t piece = end - start < REACH_CHUNK_BYTES ? end - start : REACH_CHUNK_BYTES;
+        if (worker->batch_count == REACH_BATCH || worker->batch_bytes + piece > REACH_BUFFER_BYTES) {
+            reach_flush(worker);
+        }
+        worker->batch[worker->batch_count].iov_base = (void *)start;
+        worker->batch[worker->batch_count].iov_len = piece;
+        worker->sources[worker->batch_count] = (uint8_t)source;
+        worker->batch_count++;
+        worker->batch_bytes += piece;
+        start += piece;
+    }
+}
+
+// Scan queued regions and this worker's blocks until it has none left
+static void reach_drain(reach_worker_t *worker) {
+    reach_t *reach = worker->reach;
+    size_t i;
+
+    do {
+        while (reach_pop(worker, &i)) {
+            reach_block_t *block = &reach->blocks[i];
+            reach_add(worker, block->start, block->size, reach->leak_phase ? 0 : reach_marked(reach, i));
+        }
+        reach_flush(worker);
+    } while (!reach_deque_empty(&worker->deque) || __atomic_load_n(&reach->overflow_count, __ATOMIC_RELAXED));
+}
+
+// Take one block from another worker, starting at a random victim
+static int reach_steal(reach_worker_t *worker) {
+    reach_t *reach = worker->reach;
+    unsigned int start = (unsigned int)(random_next(&worker->rng) % reach->worker_count);
+
+    for (unsigned int n = 0; n < reach->worker_count; n++) {
+        reach_worker_t *victim = &reach->workers[(start + n) % reach->worker_count];
+        size_t i;
+        if (victim != worker && reach_deque_steal(&victim->deque, &i)) {
+            reach_push(worker, i);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int reach_work_left(reach_t *reach) {
+    if (__atomic_load_n(&reach->overflow_count, __ATOMIC_RELAXED)) return 1;
+    for (unsigned int i = 0; i < reach->worker_count; i++) {
+        if (!reach_deque_empty(&reach->workers[i].deque)) return 1;
+    }
+    return 0;
+}
+
+// Drain and steal until every worker is idle with nothing left to take.
+// Only a busy worker adds work, so once all are idle none can appear.
+static void reach_work(reach_worker_t *worker) {
+    reach_t *reach = worker->reach;
+
+    for (;;) {
+        reach_drain(worker);
+        if (reach_steal(worker)) continue;
+
+        __atomic_add_fetch(&reach->idle, 1, __ATOMIC_SEQ_CST);
+        for (;;) {
+            if (__atomic_load_n(&reach->idle, __ATOMIC_SEQ_CST) == reach->worker_count) return;
+            if (reach_work_left(reach)) {
+                __atomic_sub_fetch(&reach->idle, 1, __ATOMIC_SEQ_CST);
+                break;
+            }
+            sched_yield();
+        }
+    }
+}
+
+// Writable segments of every module but this one, whose globals only hold
+// tracker state
+static int reach_add_module(struct dl_phdr_info *info, size_t size, void *arg) {
+    reach_worker_t *worker = arg;
+    (void)size;
+
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+        uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+        if (phdr->p_type == PT_LOAD && (uintptr_t)&reach_mode - start < phdr->p_memsz) return 0;
+    }
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+        if (phdr->p_type == PT_LOAD && (phdr->p_flags & PF_W)) {
+            reach_add(worker, info->dlpi_addr + phdr->p_vaddr, phdr->p_memsz, REACH_REACHABLE);
+        } else if (phdr->p_type == PT_TLS) {
+            worker->reach->tls_bytes += phdr->p_memsz + phdr->p_align;
+        }
+    }
+    return 0;
+}
+
+// glibc keeps a thread's dynamic TLS vector one entry past the start of
+// the block it allocated, in the descriptor's second word on x86-64
+static void reach_add_dtv(reach_worker_t *worker, uintptr_t thread_pointer) {
+#if defined(__x86_64__)
+    uintptr_t dtv = 0;
+    struct iovec local = { &dtv, sizeof(dtv) };
+    struct iovec remote = { (void *)(thread_pointer + sizeof(void *)), sizeof(dtv) };
+    if (process_vm_readv(worker->reach->pid, &local, 1, &remote, 1, 0) == sizeof(dtv) && dtv) {
+        reach_visit(worker, dtv - 2 * sizeof(void *), REACH_REACHABLE);
+    }
+#else
+    (void)worker;
+    (void)thread_pointer;
+#endif
+}
+
+// Queue the roots; the blocks they mark go to this worker's deque, where
+// the others steal them from (reporting thread only)
+__attribute__((noinline))
+static void reach_add_roots(reach_worker_t *worker) {
+    reach_t *reach = worker->reach;
+
+    // Callee-saved registers, spilled below everything scanned on this stack
+    jmp_buf registers;
+    setjmp(registers);
+
+    dl_iterate_phdr(reach_add_module, worker);
+    reach_add(worker, (uintptr_t)bootstrap_arena, __atomic_load_n(&bootstrap_used, __ATOMIC_RELAXED),
+              REACH_REACHABLE);
+
+    // glibc sizes the static TLS area, its own descriptor and surplus
+    // included; fall back to the modules' TLS segments
+    const uint32_t *tcb_size = dlsym(RTLD_DEFAULT, "_thread_db_sizeof_pthread");
+    void (*tls_static_info)(size_t *, size_t *) =
+        (void (*)(size_t *, size_t *))dlsym(RTLD_DEFAULT, "_dl_get_tls_static_info");
+    reach->tcb_bytes = tcb_size ? *tcb_size : REACH_TCB_BYTES;
+    if (tls_static_info) {
+        size_t size, align;
+        tls_static_info(&size, &align);
+        if (size > reach->tcb_bytes) reach->tls_bytes = size - reach->tcb_bytes;
+    }
+
+    if (!thread_reach) reach_register_thread();
+    for (int i = 0; i < REACH_MAX_THREADS; i++) {
+        reach_thread_t *entry = &reach_threads[i];
+        if (__atomic_load_n(&entry->used, __ATOMIC_ACQUIRE) != 1) continue;
+
+        uintptr_t low = entry == thread_reach ? (uintptr_t)&registers : entry->stack_low;
+        reach_add(worker, low, entry->stack_high - low, REACH_REACHABLE);
+
+        // Threads glibc started keep their TLS in the stack block; the
+        // main thread's lies elsewhere
+        if (entry->thread_pointer - entry->stack_low >= entry->stack_high - entry->stack_low) {
+            reach_add(worker, entry->thread_pointer - reach->tls_bytes, reach->tls_bytes + reach->tcb_bytes,
+                      REACH_REACHABLE);
+        }
+        reach_add_dtv(worker, entry->thread_pointer);
+    }
+    reach_flush(worker);
+}
+
+static void reach_phase_mark(reach_worker_t *worker) {
+    if (worker->index == 0) reach_add_roots(worker);
+    reach_work(worker);
+}
+
+static void reach_phase_unpack(reach_worker_t *worker) {
+    reach_t *reach = worker->reach;
+    size_t begin, end;
+    reach_slice(worker, &begin, &end);
+
+    for (size_t i = begin; i < end; i++) {
+        reach->blocks[i].state = (uint8_t)reach_marked(reach, i);
+    }
+}
+
+// Split the unreached blocks into cliques, memcheck style: each unreached
+// block not yet in a clique leads a new one, and every unreached block it
+// leads to joins it as indirectly lost, earlier leaders included
+static void reach_classify(reach_t *reach) {
+    reach_worker_t *worker = &reach->workers[0];
+
+    reach->leak_phase = 1;
+    for (size_t i = 0; i < reach->count; i++) {
+        if (reach->blocks[i].state != REACH_UNSEEN) continue;
+        reach->blocks[i].state = REACH_DEFINITE;
+        reach->leader = i;
+        reach_push(worker, i);
+        reach_drain(worker);
+    }
+}
+
+// Index the snapshot, mark from the roots and classify every block (no
+// shard locks needed). Fails only if the page map cannot be allocated.
+static int reach_scan(reach_t *reach) {
+    if (reach_index(reach) != 0) return -1;
+    reach_run(reach, reach_phase_mark);
+    reach_run(reach, reach_phase_unpack);
+
+    // The clique walk runs on the reporting thread alone
+    reach_stop_workers(reach);
+    reach_classify(reach);
+    return 0;
+}
+
+// Totals per class, then the lost blocks grouped by stack within each
+// lost class (caller holds symbolizer_lock)
+static void print_reachability(reach_t *reach) {
+    static const struct {
+        int state;
+        const char *name;
+        const char *label;
+    } classes[] = {
+        { REACH_DEFINITE, "Definitely lost", "DEFINITELY LOST" },
+        { REACH_INDIRECT, "Indirectly lost", "INDIRECTLY LOST" },
+        { REACH_POSSIBLE, "Possibly lost", "POSSIBLY LOST" },
+        { REACH_REACHABLE, "Still reachable", NULL },
+    };
+    size_t bytes[REACH_SUPPRESSED + 1] = { 0 };
+    size_t blocks[REACH_SUPPRESSED + 1] = { 0 };
+
+    prepare_suppressions();
+    for (size_t i = 0; i < reach->count; i++) {
+        reach_block_t *block = &reach->blocks[i];
+        if (suppressed_kinds(block->stack_id, block->api) & (1u << block->state)) block->state = REACH_SUPPRESSED;
+        bytes[block->state] += block->size;
+        blocks[block->state]++;
+    }
+
+    fprintf(stderr, "\nLEAK SUMMARY (pointer scan of %zu live blocks):\n", reach->count);
+    for (size_t c = 0; c < sizeof(classes) / sizeof(classes[0]); c++) {
+        fprintf(stderr, "  %s: %zu bytes in %zu blocks%s\n", classes[c].name,
+                bytes[classes[c].state], blocks[classes[c].state],
+                classes[c].label ? "" : " (not listed)");
+    }
+    if (suppress_rule_count) {
+        fprintf(stderr, "  Suppressed: %zu bytes in %zu blocks\n", bytes[REACH_SUPPRESSED], blocks[REACH_SUPPRESSED]);
+    }
+    size_t missed = __atomic_load_n(&reach_threads_missed, __ATOMIC_RELAXED);
+    if (missed) {
+        fprintf(stderr, "  Stacks of %zu threads not scanned (over %d threads)\n",
+                missed, REACH_MAX_THREADS);
+    }
+
+    if (blocks[REACH_DEFINITE] + blocks[REACH_INDIRECT] + blocks[REACH_POSSIBLE] == 0) {
+        fprintf(stderr, "No memory leaks detected!\n");
+        return;
+    }
+
+    uint32_t stack_count = __atomic_load_n(&stack_table.count, __ATOMIC_ACQUIRE);
+    leak_groups_t leaks;
+    if (alloc_leak_groups(&leaks, stack_count) != 0) return;
+
+    fprintf(stderr, "\nLEAKED ALLOCATIONS:\n");
+    for (size_t c = 0; classes[c].label; c++) {
+        if (!blocks[classes[c].state]) continue;
+
+        memset(leaks.groups, 0, sizeof(leak_group_t) * stack_count);
+        leaks.count = 0;
+        for (size_t i = 0; i < reach->count; i++) {
+            reach_block_t *block = &reach->blocks[i];
+            if (block->state == classes[c].state) {
+                group_block(&leaks, block->stack_id, (void *)block->start, block->size,
+                            block->birth_ns, block->api);
+            }
+        }
+        order_leak_groups(&leaks, stack_count);
+        if (aggregate_mode) {
+            for (uint32_t i = 0; i < leaks.count; i++) {
+                leaks.groups[leaks.order[i]].site = *callsite_get(leaks.order[i]);
+            }
+        }
+        print_leaks(&leaks, classes[c].label);
+    }
+    free(leaks.groups);
+    free(leaks.order);
+}
+
+static void format_duration(uint64_t ns, char *buffer, size_t size) {
+    if (ns < 1000) {
+        snprintf(buffer, size, "%lluns", (unsigned long long)ns);
+    } else if (ns < 1000000) {
+        snprintf(buffer, size, "%.3gus", ns / 1e3);
+    } else if (ns < 1000000000) {
+        snprintf(buffer, size, "%.3gms", ns / 1e6);
+    } else {
+        snprintf(buffer, size, "%.3gs", ns / 1e9);
+    }
+}
+
+static size_t *sort_frees;
+
+static int compare_frees(const void *a, const void *b) {
+    size_t frees_a = sort_frees[*(const uint32_t *)a];
+    size_t frees_b = sort_frees[*(const uint32_t *)b];
+    return frees_a < frees_b ? 1 : frees_a > frees_b ? -1 : 0;
+}
+
+// Lifetime histograms of the callsites that freed the most blocks: the
+// short-lived churn among them is what pooling or stack allocation removes
+static void print_lifetimes(void) {
+    uint32_t stack_count = __atomic_load_n(&stack_table.count, __ATOMIC_ACQUIRE);
+    uint32_t *order = malloc(sizeof(uint32_t) * stack_count);
+    size_t *frees = calloc(stack_count, sizeof(size_t));
+    if (!order || !frees) {
+        free(order);
+        free(frees);
+        return;
+    }
+
+    uint32_t count = 0;
+    for (uint32_t id = 0; id < stack_count; id++) {
+        lifetime_hist_t *hist = lifetime_get(id);
+        for (int b = 0; b < LIFETIME_BUCKETS; b++) {
+            frees[id] += __atomic_load_n(&hist->buckets[b], __ATOMIC_RELAXED);
+        }
+        if (frees[id] > 0) order[count++] = id;
+    }
+    sort_frees = frees;
+    qsort(order, count, sizeof(uint32_t), compare_frees);
+    if (count > LIFETIME_MAX_REPORTED) count = LIFETIME_MAX_REPORTED;
+
+    pthread_mutex_lock(&symbolizer_lock);
+    symbolize_stacks(order, count);
+
+    fprintf(stderr, "=== ALLOCATION LIFETIMES ===\n");
+    if (count == 0) {
+        fprintf(stderr, "No tracked blocks were freed\n");
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t id = order[i];
+        lifetime_hist_t hist = *lifetime_get(id);
+        size_t peak = 0;
+        size_t seen = 0;
+        int median = -1;
+        for (int b = 0; b < LIFETIME_BUCKETS; b++) {
+            if (hist.buckets[b] > peak) peak = hist.buckets[b];
+            seen += hist.buckets[b];
+            if (median < 0 && seen * 2 >= frees[id]) median = b;
+        }
+
+        char bound[32];
+        format_duration(1ull << median, bound, sizeof(bound));
+        fprintf(stderr, "  LIFETIME: %zu blocks freed, median lifetime under %s\n", frees[id], bound);
+        print_stack(id);
+
+        for (int b = 0; b < LIFETIME_BUCKETS; b++) {
+            if (hist.buckets[b] == 0) continue;
+
+            char lower[32];
+            char upper[32];
+            char bar[41];
+            format_duration(b ? 1ull << (b - 1) : 0, lower, sizeof(lower));
+            if (b == LIFETIME_BUCKETS - 1) {
+                snprintf(upper, sizeof(upper), "longer");
+            } else {
+                format_duration(1ull << b, upper, sizeof(upper));
+            }
+            size_t width = (hist.buckets[b] * 40 + peak - 1) / peak;
+            memset(bar, '#', width);
+            bar[width] = '\0';
+            fprintf(stderr, "      %7s - %-7s %10zu %s\n", lower, upper, hist.buckets[b], bar);
+        }
+    }
+    fprintf(stderr, "=========================\n\n");
+    pthread_mutex_unlock(&symbolizer_lock);
+
+    free(order);
+    free(frees);
+}
+
+static size_t *sort_copied;
+
+static int compare_copied(const void *a, const void *b) {
+    size_t copied_a = sort_copied[*(const uint32_t *)a];
+    size_t copied_b = sort_copied[*(const uint32_t *)b];
+    return copied_a < copied_b ? 1 : copied_a > copied_b ? -1 : 0;
+}
+
+// realloc callsites by bytes copied, flagging growth patterns that make a
+// buffer move or resize far more often than geometric growth would
+static void print_reallocs(void) {
+    static const char *factor_names[REALLOC_FACTOR_BUCKETS] = {
+        "<1.125x", "<1.25x", "<1.5x", "<2x", "<4x", ">=4x"
+    };
+    uint32_t stack_count = __atomic_load_n(&stack_table.count, __ATOMIC_ACQUIRE);
+    uint32_t *order = malloc(sizeof(uint32_t) * stack_count);
+    size_t *copied = calloc(stack_count, sizeof(size_t));
+    if (!order || !copied) {
+        free(order);
+        free(copied);
+        return;
+    }
+
+    uint32_t count = 0;
+    for (uint32_t id = 0; id < stack_count; id++) {
+        realloc_stats_t *stats = realloc_stats_get(id);
+        if (__atomic_load_n(&stats->count, __ATOMIC_RELAXED) > 0) {
+            // Callsites that never move still rank by how often they resize
+            copied[id] = __atomic_load_n(&stats->bytes_copied, __ATOMIC_RELAXED) + 1;
+            order[count++] = id;
+        }
+    }
+    sort_copied = copied;
+    qsort(order, count, sizeof(uint32_t), compare_copied);
+    if (count > REALLOC_MAX_REPORTED) count = REALLOC_MAX_REPORTED;
+
+    pthread_mutex_lock(&symbolizer_lock);
+    symbolize_stacks(order, count);
+
+    fprintf(stderr, "=== REALLOC PROFILE ===\n");
+    if (count == 0) {
+        fprintf(stderr, "No tracked reallocs\n");
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t id = order[i];
+        realloc_stats_t stats = *realloc_stats_get(id);
+
+        fprintf(stderr, "  REALLOC: %zu calls, %zu moved (%zu bytes copied), %zu in place, %zu grew",
+                stats.count, stats.moves, stats.bytes_copied, stats.count - stats.moves, stats.grows);
+        if (stats.grows > 0) {
+            double mean_factor = exp2((double)stats.growth_log2 / 1024 / stats.grows);
+            size_t mean_step = stats.growth_bytes / stats.grows;
+            fprintf(stderr, " by x%.2f and %zu bytes on average\n", mean_factor, mean_step);
+
+            fprintf(stderr, "    growth factors:");
+            for (int b = 0; b < REALLOC_FACTOR_BUCKETS; b++) {
+                if (stats.factors[b]) fprintf(stderr, " %s %zu", factor_names[b], stats.factors[b]);
+            }
+            fprintf(stderr, "\n");
+
+            if (stats.grows >= REALLOC_MIN_GROWS && mean_step <= REALLOC_STEP_BYTES) {
+                fprintf(stderr, "    WARNING: grows an element at a time; reserve capacity or grow geometrically\n");
+            } else if (stats.grows >= REALLOC_MIN_GROWS && mean_factor < REALLOC_MIN_FACTOR) {
+                fprintf(stderr, "    WARNING: growth factor below x%.1f; grow geometrically\n",
+                        REALLOC_MIN_FACTOR);
+            }
+        } else {
+            fprintf(stderr, "\n");
+        }
+        print_stack(id);
+    }
+    fprintf(stderr, "=========================\n\n");
+    pthread_mutex_unlock(&symbolizer_lock);
+
+    free(order);
+    free(copied);
+}
+
+// Thread id, plus its name while the thread is still running
+static void thread_label(uint16_t index, char *buffer, size_t size) {
+    if (index == THREAD_INDEX_OVERFLOW) {
+        snprintf(buffer, size, "other threads");
+        return;
+    }
+
+    uint32_t tid = thread_index_tids[index];
+    char path[64];
+    char name[32] = "";
+    snprintf(path, sizeof(path), "/proc/self/task/%u/comm", tid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        ssize_t n = read(fd, name, sizeof(name) - 1);
+        name[n > 0 ? n : 0] = '\0';
+        char *newline = strchr(name, '\n');
+        if (newline) *newline = '\0';
+        close(fd);
+    }
+    if (name[0]) {
+        snprintf(buffer, size, "thread %u (%s)", tid, name);
+    } else {
+        snprintf(buffer, size, "thread %u", tid);
+    }
+}
+
+static uint16_t pair_alloc_thread(const thread_pair_t *pair) {
+    return (uint16_t)(pair->key >> 48);
+}
+
+static uint16_t pair_free_thread(const thread_pair_t *pair) {
+    return (uint16_t)(pair->key >> 32);
+}
+
+static uint32_t pair_stack(const thread_pair_t *pair) {
+    return (uint32_t)pair->key;
+}
+
+// Thread pair first, then stack
+static int compare_pairs_by_threads(const void *a, const void *b) {
+    uint64_t key_a = ((const thread_pair_t *)a)->key;
+    uint64_t key_b = ((const thread_pair_t *)b)->key;
+    return key_a < key_b ? -1 : key_a > key_b ? 1 : 0;
+}
+
+// Stack first, then most bytes
+static int compare_pairs_by_stack(const void *a, const void *b) {
+    const thread_pair_t *pair_a = a;
+    const thread_pair_t *pair_b = b;
+    if (pair_stack(pair_a) != pair_stack(pair_b)) {
+        return pair_stack(pair_a) < pair_stack(pair_b) ? -1 : 1;
+    }
+    return pair_a->bytes < pair_b->bytes ? 1 : pair_a->bytes > pair_b->bytes ? -1 : 0;
+}
+
+static int compare_pairs_by_bytes(const void *a, const void *b) {
+    size_t bytes_a = ((const thread_pair_t *)a)->bytes;
+    size_t bytes_b = ((const thread_pair_t *)b)->bytes;
+    return bytes_a < bytes_b ? 1 : bytes_a > bytes_b ? -1 : 0;
+}
+
+// Remote frees of one callsite, with its run in the stack-sorted pairs
+typedef struct {
+    uint32_t stack_id;
+    size_t first;
+    size_t local_blocks;
+    size_t remote_blocks;
+    size_t remote_bytes;
+} remote_site_t;
+
+static int compare_remote_sites(const void *a, const void *b) {
+    size_t bytes_a = ((const remote_site_t *)a)->remote_bytes;
+    size_t bytes_b = ((const remote_site_t *)b)->remote_bytes;
+    return bytes_a < bytes_b ? 1 : bytes_a > bytes_b ? -1 : 0;
+}
+
+// Allocating thread by freeing thread matrix, then the callsites whose
+// blocks are freed on another thread most, with their main thread pairs
+static void print_thread_frees(void) {
+    thread_pair_t *pairs = malloc(sizeof(thread_pair_t) * THREAD_PAIR_SLOTS);
+    thread_pair_t *matrix = malloc(sizeof(thread_pair_t) * THREAD_PAIR_SLOTS);
+    remote_site_t *sites = malloc(sizeof(remote_site_t) * THREAD_PAIR_SLOTS);
+    uint32_t *ids = malloc(sizeof(uint32_t) * THREAD_MAX_REPORTED);
+    if (!pairs || !matrix || !sites || !ids) {
+        free(pairs);
+        free(matrix);
+        free(sites);
+        free(ids);
+        return;
+    }
+
+    size_t count = 0;
+    size_t local_blocks = 0;
+    size_t remote_blocks = 0;
+    size_t remote_bytes = 0;
+    for (size_t i = 0; i < THREAD_PAIR_SLOTS; i++) {
+        if (!__atomic_load_n(&thread_pairs[i].key, __ATOMIC_ACQUIRE)) continue;
+        pairs[count].key = thread_pairs[i].key;
+        pairs[count].blocks = __atomic_load_n(&thread_pairs[i].blocks, __ATOMIC_RELAXED);
+        pairs[count].bytes = __atomic_load_n(&thread_pairs[i].bytes, __ATOMIC_RELAXED);
+        if (pair_alloc_thread(&pairs[count]) == pair_free_thread(&pairs[count])) {
+            local_blocks += pairs[count].blocks;
+        } else {
+            remote_blocks += pairs[count].blocks;
+            remote_bytes += pairs[count].bytes;
+        }
+        count++;
+    }
+
+    // Matrix: merge callsites of each remote thread pair
+    qsort(pairs, count, sizeof(thread_pair_t), compare_pairs_by_threads);
+    size_t matrix_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (pair_alloc_thread(&pairs[i]) == pair_free_thread(&pairs[i])) continue;
+        uint64_t threads = pairs[i].key >> 32;
+        if (matrix_count == 0 || matrix[matrix_count - 1].key != threads << 32) {
+            matrix[matrix_count].key = threads << 32;
+            matrix[matrix_count].blocks = 0;
+            matrix[matrix_count].bytes = 0;
+            matrix_count++;
+        }
+        matrix[matrix_count - 1].blocks += pairs[i].blocks;
+        matrix[matrix_count - 1].bytes += pairs[i].bytes;
+    }
+    qsort(matrix, matrix_count, sizeof(thread_pair_t), compare_pairs_by_bytes);
+
+    // Callsites: one run of pairs per stack, largest pair first
+    qsort(pairs, count, sizeof(thread_pair_t), compare_pairs_by_stack);
+    size_t site_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (site_count == 0 || sites[site_count - 1].stack_id != pair_stack(&pairs[i])) {
+            memset(&sites[site_count], 0, sizeof(remote_site_t));
+            sites[site_count].stack_id = pair_stack(&pairs[i]);
+            sites[site_count].first = i;
+            site_count++;
+        }
+        remote_site_t *site = &sites[site_count - 1];
+        if (pair_alloc_thread(&pairs[i]) == pair_free_thread(&pairs[i])) {
+            site->local_blocks += pairs[i].blocks;
+        } else {
+            site->remote_blocks += pairs[i].blocks;
+            site->remote_bytes += pairs[i].bytes;
+        }
+    }
+    qsort(sites, site_count, sizeof(remote_site_t), compare_remote_sites);
+    while (site_count > 0 && sites[site_count - 1].remote_blocks == 0) site_count--;
+    if (site_count > THREAD_MAX_REPORTED) site_count = THREAD_MAX_REPORTED;
+
+    pthread_mutex_lock(&symbolizer_lock);
+    for (size_t i = 0; i < site_count; i++) ids[i] = sites[i].stack_id;
+    symbolize_stacks(ids, (uint32_t)site_count);
+
+    size_t total_blocks = local_blocks + remote_blocks;
+    fprintf(stderr, "=== CROSS-THREAD FREES ===\n");
+    fprintf(stderr, "Freed on another thread: %zu of %zu blocks (%.1f%%), %zu bytes\n",
+            remote_blocks, total_blocks, total_blocks ? 100.0 * remote_blocks / total_blocks : 0.0,
+            remote_bytes);
+    if (thread_pairs_dropped) {
+        fprintf(stderr, "Thread pair table full: %zu frees not counted\n", thread_pairs_dropped);
+    }
+
+    char alloc_label[64];
+    char free_label[64];
+    for (size_t i = 0; i < matrix_count && i < THREAD_MAX_REPORTED; i++) {
+        thread_label(pair_alloc_thread(&matrix[i]), alloc_label, sizeof(alloc_label));
+        thread_label(pair_free_thread(&matrix[i]), free_label, sizeof(free_label));
+        fprintf(stderr, "  %s -> %s: %zu blocks, %zu bytes\n",
+                alloc_label, free_label, matrix[i].blocks, matrix[i].bytes);
+    }
+
+    for (size_t i = 0; i < site_count; i++) {
+        remote_site_t *site = &sites[i];
+        fprintf(stderr, "  REMOTE: %zu of %zu blocks freed on another thread, %zu bytes\n",
+                site->remote_blocks, site->remote_blocks + site->local_blocks, site->remote_bytes);
+        for (size_t p = site->first, shown = 0;
+             p < count && pair_stack(&pairs[p]) == site->stack_id && shown < 3; p++) {
+            if (pair_alloc_thread(&pairs[p]) == pair_free_thread(&pairs[p])) continue;
+            thread_label(pair_alloc_thread(&pairs[p]), alloc_label, sizeof(alloc_label));
+            thread_label(pair_free_thread(&pairs[p]), free_label, sizeof(free_label));
+            fprintf(stderr, "    %s -> %s: %zu blocks\n", alloc_label, free_label, pairs[p].blocks);
+            shown++;
+        }
+        print_stack(site->stack_id);
+    }
+    fprintf(stderr, "=========================\n\n");
+    pthread_mutex_unlock(&symbolizer_lock);
+
+    free(pairs);
+    free(matrix);
+    free(sites);
+    free(ids);
+}
+
+// Print leak report
+void print_leak_report() {
+    if (!initialized) return;
+
+    if (buffered_mode) {
+        drain_rings(0);
+    }
+
+    int was_in_tracker = in_tracker;
+    in_tracker = 1;
+
+    // Only the snapshot is taken under the shard locks; symbolizing and
+    // printing happen after they are released
+    leak_groups_t leaks;
+    reach_t reach;
+    tracker_totals_t totals;
+    lock_all_shards();
+    sum_shards(&totals, 0);
+    int reached = reach_mode && totals.current_usage > 0 ? reach_collect(&reach) : -1;
+    int exporting = collapsed_path[0] || pprof_path[0];
+    int collected = (totals.current_usage > 0 && reached != 0) || exporting ? collect_leaks(&leaks) : -1;
+    unlock_all_shards();
+    if (reached == 0 && reach_scan(&reach) != 0) {
+        reach_release(&reach);
+        reached = -1;
+        if (collected != 0) {
+            lock_all_shards();
+            collected = collect_leaks(&leaks);
+            unlock_all_shards();
+        }
+    }
+    if (reached != 0 && reach_mode && totals.current_usage > 0) {
+        fprintf(stderr, "Memory Tracker: Pointer scan unavailable, listing every live block\n");
+    }
+
+    fprintf(stderr, "\n=== MEMORY LEAK REPORT (PID: %d) ===\n", getpid());
+    if (sample_interval) {
+        fprintf(stderr, "Sampling: one sample per %.0f bytes on average, figures below are estimates\n",
+                sample_interval);
+    }
+    fprintf(stderr, "Total allocated: %zu bytes (%zu allocations)\n",
+            totals.total_allocated, totals.allocation_count);
+    fprintf(stderr, "Total freed: %zu bytes (%zu frees)\n",
+            totals.total_freed, totals.free_count);
+    fprintf(stderr, "Current usage: %zu bytes\n", totals.current_usage);
+    fprintf(stderr, "Peak usage: %zu bytes\n", totals.peak_usage);
+    if (guard_pool) {
+        fprintf(stderr, "Guarded allocations: %zu, in %u guard slots\n",
+                __atomic_load_n(&guard_sampled, __ATOMIC_RELAXED), guard_slot_count);
+    }
+    if (quarantine_budget) {
+        pthread_mutex_lock(&quarantine_lock);
+        fprintf(stderr, "Quarantine: %zu blocks (%zu bytes) held, %zu evicted, %zu errors\n",
+                quarantine_count, quarantine_bytes, quarantine_evicted,
+                __atomic_load_n(&quarantine_errors, __ATOMIC_RELAXED));
+        pthread_mutex_unlock(&quarantine_lock);
+    }
+
+    if (reached == 0) {
+        pthread_mutex_lock(&symbolizer_lock);
+        print_reachability(&reach);
+        pthread_mutex_unlock(&symbolizer_lock);
+        reach_release(&reach);
+    } else if (totals.current_usage > 0 && collected == 0) {
+        size_t suppressed_bytes = 0, suppressed_blocks = 0;
+        pthread_mutex_lock(&symbolizer_lock);
+        drop_suppressed(&leaks, &suppressed_bytes, &suppressed_blocks);
+        if (suppressed_blocks) {
+            fprintf(stderr, "Suppressed: %zu bytes in %zu blocks\n", suppressed_bytes, suppressed_blocks);
+        }
+        if (leaks.count) {
+            fprintf(stderr, "\nLEAKED ALLOCATIONS:\n");
+            print_leaks(&leaks, "LEAK");
+        } else {
+            fprintf(stderr, "No memory leaks detected!\n");
+        }
+        pthread_mutex_unlock(&symbolizer_lock);
+    } else if (totals.current_usage > 0) {
+        fprintf(stderr, "\nLEAKED ALLOCATIONS:\n");
+    } else {
+        fprintf(stderr, "No memory leaks detected!\n");
+    }
+
+    fprintf(stderr, "=========================\n\n");
+
+    if (exporting && collected == 0) {
+        pthread_mutex_lock(&symbolizer_lock);
+        export_profiles(&leaks);
+        pthread_mutex_unlock(&symbolizer_lock);
+    }
+    if (collected == 0) {
+        free(leaks.groups);
+        free(leaks.order);
+    }
+
+    if (lifetime_mode) {
+        print_lifetimes();
+    }
+    if (realloc_mode) {
+        print_reallocs();
+    }
+    if (thread_mode) {
+        print_thread_frees();
+    }
+    in_tracker = was_in_tracker;
+}
+
+// Periodic snapshots. Each one reads the live bytes of every callsite from
+// the counters maintained on alloc/free, so it never walks the allocation
+// table or takes a shard lock. A callsite whose live bytes rose in each of
+// the last snapshot_growth snapshots is reported, fastest growth first.
+
+// Growth history of one callsite, owned by the snapshot thread
+typedef struct {
+    size_t last_bytes;
+    size_t run_start_bytes;     // Live bytes before the current run of growth
+    uint32_t run_length;        // Consecutive snapshots that grew
+} growth_state_t;
+
+typedef struct {
+    uint32_t id;
+    double rate;                // Bytes per second over the run
+} growth_suspect_t;
+
+static growth_state_t *growth_history = NULL;
+static uint32_t growth_capacity = 0;
+static unsigned long snapshot_count = 0;
+static pthread_t snapshot_thread;
+static int snapshot_running = 0;
+static int snapshot_stop = 0;
+static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t snapshot_wake = PTHREAD_COND_INITIALIZER;
+
+static int compare_suspects(const void *a, const void *b) {
+    double rate_a = ((const growth_suspect_t *)a)->rate;
+    double rate_b = ((const growth_suspect_t *)b)->rate;
+    return rate_a < rate_b ? 1 : rate_a > rate_b ? -1 : 0;
+}
+
+static void take_snapshot(void) {
+    uint32_t count = __atomic_load_n(&stack_table.count, __ATOMIC_ACQUIRE);
+
+    if (count > growth_capacity) {
+        growth_state_t *history = realloc(growth_history, sizeof(growth_state_t) * count);
+        if (!history) return;
+        memset(history + growth_capacity, 0, sizeof(growth_state_t) * (count - growth_capacity));
+        growth_history = history;
+        growth_capacity = count;
+    }
+    growth_suspect_t *suspects = malloc(sizeof(growth_suspect_t) * count);
+    if (!suspects) return;
+
+    uint32_t suspect_count = 0;
+    snapshot_count++;
+    for (uint32_t id = 0; id < count; id++) {
+        callsite_t *site = callsite_get(id);
+        growth_state_t *history = &growth_history[id];
+        size_t bytes = __atomic_load_n(&site->live_bytes, __ATOMIC_RELAXED);
+
+        if (bytes > history->last_bytes) {
+            history->run_length++;
+        } else {
+            history->run_start_bytes = bytes;
+            history->run_length = 0;
+        }
+        history->last_bytes = bytes;
+
+        if (history->run_length >= snapshot_growth) {
+            suspects[suspect_count].id = id;
+            suspects[suspect_count].rate = (bytes - history->run_start_bytes) /
+                                           (history->run_length * snapshot_interval);
+            suspect_count++;
+        }
+    }
+
+    if (suspect_count > 0) {
+        qsort(suspects, suspect_count, sizeof(growth_suspect_t), compare_suspects);
+        if (suspect_count > SNAPSHOT_MAX_REPORTED) suspect_count = SNAPSHOT_MAX_REPORTED;
+
+        uint32_t *ids = malloc(sizeof(uint32_t) * suspect_count);
+        pthread_mutex_lock(&symbolizer_lock);
+        if (ids) {
+            for (uint32_t i = 0; i < suspect_count; i++) ids[i] = suspects[i].id;
+            symbolize_stacks(ids, suspect_count);
+        }
+
+        fprintf(stderr, "\n=== GROWING CALLSITES (snapshot %lu) ===\n", snapshot_count);
+        for (uint32_t i = 0; i < suspect_count; i++) {
+            uint32_t id = suspects[i].id;
+            callsite_t *site = callsite_get(id);
+            fprintf(stderr, "  GROWTH: %.0f bytes/s over %u snapshots, live %zu bytes in %zu blocks from %s\n",
+                    suspects[i].rate, growth_history[id].run_length,
+                    __atomic_load_n(&site->live_bytes, __ATOMIC_RELAXED),
+                    __atomic_load_n(&site->live_count, __ATOMIC_RELAXED),
+                    api_names[__atomic_load_n(&site->api, __ATOMIC_RELAXED)]);
+            print_stack(id);
+        }
+        fprintf(stderr, "=========================\n\n");
+        pthread_mutex_unlock(&symbolizer_lock);
+        free(ids);
+    }
+    free(suspects);
+}
+
+// Snapshot on a fixed schedule until stop_snapshots wakes us
+static void *snapshot_main(void *arg) {
+    (void)arg;
+    in_tracker = 1;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    long interval_ns = (long)((snapshot_interval - (long)snapshot_interval) * 1e9);
+
+    pthread_mutex_lock(&snapshot_lock);
+    while (!snapshot_stop) {
+        deadline.tv_sec += (time_t)snapshot_interval;
+        deadline.tv_nsec += interval_ns;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        int rc = 0;
+        while (!snapshot_stop && rc != ETIMEDOUT) {
+            rc = pthread_cond_timedwait(&snapshot_wake, &snapshot_lock, &deadline);
+        }
+        if (snapshot_stop) break;
+
+        pthread_mutex_unlock(&snapshot_lock);
+        take_snapshot();
+        pthread_mutex_lock(&snapshot_lock);
+    }
+    pthread_mutex_unlock(&snapshot_lock);
+    return NULL;
+}
+
+static void start_snapshots(void) {
+    in_tracker = 1;
+    if (pthread_create(&snapshot_thread, NULL, snapshot_main, NULL) == 0) {
+        snapshot_running = 1;
+    } else {
+        fprintf(stderr, "Memory Tracker: Failed to start snapshot thread\n");
+    }
+    in_tracker = 0;
+}
+
+static void stop_snapshots(void) {
+    if (!snapshot_running) return;
+    pthread_mutex_lock(&snapshot_lock);
+    snapshot_stop = 1;
+    pthread_cond_signal(&snapshot_wake);
+    pthread_mutex_unlock(&snapshot_lock);
+    pthread_join(snapshot_thread, NULL);
+    snapshot_running = 0;
+}
+
+// Runtime control. MEMTRACK_CONTROL=signals maps SIGUSR1 to "toggle" and
+// SIGUSR2 to "report"; any other value is the path of a Unix socket that
+// takes one command per line: on, off, toggle, report or flush. Requests
+// are carried out by a dedicated thread, never in a signal handler, and
+// the application keeps running throughout.
+static const char *control_names[CONTROL_COUNT] = {
+    NULL, "on", "off", "toggle", "report", "flush"
+};
+
+// Empty the live tables and zero every counter, callsite statistic and the
+// sample filter (caller holds every shard lock, records already released).
+// Anonymous pages read back as zeroes once discarded, so big tables are
+// cleared without being touched, and in a forked child without being
+// copied away from the parent first.
+static void clear_tracking_state(void) {
+    for (unsigned int s = 0; s < tracker.shard_count; s++) {
+        tracker_shard_t *shard = &tracker.shards[s];
+
+        if (shard->old_table.slots) {
+            slot_table_destroy(&shard->old_table);
+        }
+        madvise(shard->table.slots, sizeof(table_slot_t) * shard->table.capacity, MADV_DONTNEED);
+        shard->table.count = 0;
+        shard->migrate_pos = 0;
+        shard->total_allocated = 0;
+        shard->total_freed = 0;
+        shard->current_usage = 0;
+        shard->allocation_count = 0;
+        shard->free_count = 0;
+        memset(shard->live_by_class, 0, sizeof(shard->live_by_class));
+        memset(shard->allocs_by_class, 0, sizeof(shard->allocs_by_class));
+    }
+    process_usage = 0;
+    process_peak = 0;
+    thread_usage_batch = 0;
+
+    // Callsite counters and histograms only change under a shard lock, and
+    // realloc statistics only while tracking is on
+    for (unsigned int chunk = 0; chunk < STACK_MAX_CHUNKS; chunk++) {
+        if (stack_table.sites[chunk]) {
+            madvise(stack_table.sites[chunk], sizeof(callsite_t) << STACK_CHUNK_SHIFT, MADV_DONTNEED);
+        }
+        if (stack_table.lifetimes[chunk]) {
+            madvise(stack_table.lifetimes[chunk], sizeof(lifetime_hist_t) << STACK_CHUNK_SHIFT,
+                    MADV_DONTNEED);
+        }
+        if (stack_table.reallocs[chunk]) {
+            madvise(stack_table.reallocs[chunk], sizeof(realloc_stats_t) << STACK_CHUNK_SHIFT,
+                    MADV_DONTNEED);
+        }
+    }
+    if (thread_pairs) {
+        madvise(thread_pairs, sizeof(thread_pair_t) * THREAD_PAIR_SLOTS, MADV_DONTNEED);
+        thread_pairs_dropped = 0;
+    }
+    if (sample_filter) {
+        madvise(sample_filter, (size_t)1 << SAMPLE_FILTER_BITS, MADV_DONTNEED);
+    }
+}
+
+// Drop every live block and counter so a new tracking window starts empty
+// (caller holds control_lock, tracking is off). Blocks allocated before the
+// window will be freed unseen, so untracked-free warnings stop from here on.
+static void reset_tracking(void) {
+    __atomic_store_n(&tracking_restarted, 1, __ATOMIC_RELAXED);
+
+    if (buffered_mode) {
+        pthread_mutex_lock(&drain_mutex);
+        drain_rings_locked(1);
+    }
+    lock_all_shards();
+
+    for (unsigned int s = 0; s < tracker.shard_count && !aggregate_mode; s++) {
+        slot_table_t *tables[2] = { &tracker.shards[s].table, &tracker.shards[s].old_table };
+
+        for (int t = 0; t < 2; t++) {
+            for (size_t i = 0; i < tables[t]->capacity; i++) {
+                uintptr_t ptr = tables[t]->slots[i].ptr;
+                if (ptr != SLOT_EMPTY && ptr != SLOT_TOMBSTONE) {
+                    slab_free(&record_cache, tables[t]->slots[i].alloc);
+                }
+            }
+        }
+    }
+    clear_tracking_state();
+
+    unlock_all_shards();
+    if (buffered_mode) {
+        pthread_mutex_unlock(&drain_mutex);
+    }
+}
+
+// Switching off only clears the flag: the disabled fast path stays a single
+// load, and reports taken meanwhile show the window as it was when it
+// ended. Switching back on starts a new window.
+static void set_tracking(int enable) {
+    if (enable == __atomic_load_n(&tracking_enabled, __ATOMIC_RELAXED)) return;
+
+    if (enable) {
+        reset_tracking();
+    }
+    __atomic_store_n(&tracking_enabled, enable, __ATOMIC_RELEASE);
+    fprintf(stderr, "Memory Tracker: Tracking %s\n", enable ? "enabled" : "disabled");
+}
+
+static void run_control_command(int command) {
+    pthread_mutex_lock(&control_lock);
+    if (!control_stopped) {
+        switch (command) {
+        case CONTROL_ON: set_tracking(1); break;
+        case CONTROL_OFF: set_tracking(0); break;
+        case CONTROL_TOGGLE: set_tracking(!tracking_enabled); break;
+        case CONTROL_REPORT: print_leak_report(); break;
+        }
+        // Trace records are visible in the file as soon as they are
+        // written; a flush or report also makes them durable
+        if ((command == CONTROL_REPORT || command == CONTROL_FLUSH) && trace_fd >= 0) {
+            fdatasync(trace_fd);
+        }
+    }
+    pthread_mutex_unlock(&control_lock);
+}
+
+// Only queues the request; the control thread does the work
+static void control_signal(int sig) {
+    int saved_errno = errno;
+    char command = sig == SIGUSR1 ? CONTROL_TOGGLE : CONTROL_REPORT;
+    ssize_t written = write(control_pipe[1], &command, 1);
+    (void)written;
+    errno = saved_errno;
+}
+
+// Read commands from one socket client, answering each line
+static void serve_control_client(void) {
+    int client = accept4(control_socket, NULL, NULL, SOCK_CLOEXEC);
+    if (client < 0) return;
+
+    // A silent client must not hold up the control thread for long
+    struct timeval timeout = { 1, 0 };
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    char buffer[256];
+    size_t used = 0;
+    ssize_t n;
+    while ((n = read(client, buffer + used, sizeof(buffer) - 1 - used)) > 0) {
+        used += n;
+        buffer[used] = '\0';
+
+        char *line = buffer;
+        char *newline;
+        while ((newline = strchr(line, '\n')) != NULL) {
+            *newline = '\0';
+            if (newline > line && newline[-1] == '\r') newline[-1] = '\0';
+
+            int command = 0;
+            for (int c = 1; c < CONTROL_COUNT; c++) {
+                if (strcmp(line, control_names[c]) == 0) command = c;
+            }
+            const char *reply = command ? "ok\n" : "unknown command\n";
+            if (command) run_control_command(command);
+            if (write(client, reply, strlen(reply)) < 0) break;
+            line = newline + 1;
+        }
+
+        used = strlen(line);
+        memmove(buffer, line, used);
+        if (used == sizeof(buffer) - 1) break;  // Overlong line
+    }
+    close(client);
+}
+
+static void *control_main(void *arg) {
+    (void)arg;
+    in_tracker = 1;
+
+    for (;;) {
+        // poll() skips the negative fd when there is no socket
+        struct pollfd fds[2] = {
+            { control_pipe[0], POLLIN, 0 },
+            { control_socket, POLLIN, 0 }
+        };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            char command;
+            while (read(control_pipe[0], &command, 1) == 1) {
+                run_control_command(command);
+            }
+        }
+        if (fds[1].revents & POLLIN) {
+            serve_control_client();
+        }
+    }
+    return NULL;
+}
+
+// Listen on path, replacing a socket left behind by an earlier run
+static int open_control_socket(const char *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 4) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Open the channel named by MEMTRACK_CONTROL and start the control thread
+static void start_control(const char *spec) {
+    in_tracker = 1;
+
+    if (pipe2(control_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+        fprintf(stderr, "Memory Tracker: Failed to create control pipe\n");
+        in_tracker = 0;
+        return;
+    }
+
+    if (strcmp(spec, "signals") == 0) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = control_signal;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGUSR1, &action, NULL);
+        sigaction(SIGUSR2, &action, NULL);
+    } else {
+        control_socket = open_control_socket(spec);
+        if (control_socket < 0) {
+            fprintf(stderr, "Memory Tracker: Cannot listen on control socket %s\n", spec);
+            in_tracker = 0;
+            return;
+        }
+        control_path = spec;
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, control_main, NULL) == 0) {
+        pthread_detach(thread);
+    } else {
+        fprintf(stderr, "Memory Tracker: Failed to start control thread\n");
+    }
+    in_tracker = 0;
+}
+
+// Guard-page sampling, after GWP-ASan. A sampled allocation gets a page of
+// its own with an inaccessible page on either side, placed against the end
+// of its page or, half of the time, against the start, so that running off
+// either end faults. On free the page is made inaccessible and discarded,
+// and the slot waits behind every other free slot before it is reused, so
+// later accesses fault too. The SIGSEGV handler reports such faults with
+// the block's allocation and free stacks, then lets the access fault again
+// under the previous disposition. Everything else costs one counter
+// decrement per allocation.
+
+static int is_guarded(void *ptr) {
+    return (char *)ptr >= guard_pool && (char *)ptr < guard_pool_end;
+}
+
+static char *guard_slot_page(unsigned int index) {
+    return guard_pool + (2 * (size_t)index + 1) * guard_page_size;
+}
+
+// Resolve a guarded block's stack while it is safe to, so the fault handler
+// can name its frames from the symbol cache. Only frames not cached yet
+// cost a lookup; if a report holds the symbolizer the frames stay raw.
+static void guard_symbolize(uint32_t stack) {
+    if (!stack || pthread_mutex_trylock(&symbolizer_lock) != 0) return;
+
+    stack_trace_t *trace = stack_trace_get(stack);
+    uint32_t cached = 0;
+    while (symbol_cache && cached < trace->depth &&
+           symbol_cache_slot((uintptr_t)trace->frames[cached])->addr) {
+        cached++;
+    }
+    if (cached < trace->depth) symbolize_stacks(&stack, 1);
+    pthread_mutex_unlock(&symbolizer_lock);
+}
+
+// Take a slot from the front of the reuse queue and place the block in it
+static void *guard_alloc(size_t size, size_t alignment) {
+    if (alignment < GUARD_MIN_ALIGNMENT) alignment = GUARD_MIN_ALIGNMENT;
+    if (size == 0) size = 1;
+    if (size > guard_page_size || alignment > guard_page_size) return NULL;
+
+    in_tracker = 1;
+    uint32_t stack = capture_stack();
+    if (!thread_tid) thread_tid = (uint32_t)syscall(SYS_gettid);
+    thread_stack_bounds();
+    guard_symbolize(stack);
+    int at_start = random_next(&guard_rng) >> 63;
+    in_tracker = 0;
+
+    pthread_mutex_lock(&guard_lock);
+    if (guard_queue_count == 0) {
+        pthread_mutex_unlock(&guard_lock);
+        return NULL;
+    }
+    uint32_t index = guard_queue[guard_queue_head];
+    char *page = guard_slot_page(index);
+    if (mprotect(page, guard_page_size, PROT_READ | PROT_WRITE) != 0) {
+        pthread_mutex_unlock(&guard_lock);
+        return NULL;
+    }
+    guard_queue_head = (guard_queue_head + 1) % guard_slot_count;
+    guard_queue_count--;
+
+    guard_slot_t *slot = &guard_slots[index];
+    slot->block.ptr = at_start ? (uintptr_t)page
+                         : ((uintptr_t)page + guard_page_size - size) & ~(uintptr_t)(alignment - 1);
+    slot->block.size = size;
+    slot->block.alloc_stack = stack;
+    slot->block.free_stack = 0;
+    slot->block.alloc_tid = thread_tid;
+    slot->block.free_tid = 0;
+    slot->state = GUARD_LIVE;
+    guard_sampled++;
+    pthread_mutex_unlock(&guard_lock);
+    return (void *)slot->block.ptr;
+}
+
+// Allocations until the next guarded one, uniform in [1, 2 * guard_rate - 1]
+// so one allocation in guard_rate is guarded on average
+static long guard_next_countdown(void) {
+    return 1 + (long)(random_next(&guard_rng) % (2 * guard_rate - 1));
+}
+
+// Route this allocation to the guarded pool?
+static void *guard_try(size_t size, size_t alignment) {
+    if (!guard_pool || in_tracker) return NULL;
+    if (guard_countdown == 0) {
+        // First allocation on this thread
+        guard_countdown = guard_next_countdown();
+    }
+    if (--guard_countdown > 0) return NULL;
+
+    guard_countdown = guard_next_countdown();
+    return guard_alloc(size, alignment);
+}
+
+// Print a problem found on a guarded or quarantined block: where it was
+// found, then the block's allocation and, if freed, free stacks
+static void report_block(const char *source, const char *problem, uint32_t stack,
+                         const block_history_t *block, int freed) {
+    uint32_t ids[3] = { stack, block->alloc_stack, block->free_stack };
+    int symbolized = pthread_mutex_trylock(&symbolizer_lock) == 0;
+    if (symbolized) {
+        symbolize_stacks(ids, 3);
+    }
+
+    fprintf(stderr, "\nMemory Tracker: %s - %s\n", source, problem);
+    if (stack) {
+        fprintf(stderr, "  at:\n");
+        print_stack(stack);
+    }
+    if (block->ptr) {
+        fprintf(stderr, "  %zu-byte block at %p allocated", block->size, (void *)block->ptr);
+        if (block->alloc_tid) fprintf(stderr, " by thread %u", block->alloc_tid);
+        fprintf(stderr, ":\n");
+        if (block->alloc_stack) {
+            print_stack(block->alloc_stack);
+        } else {
+            fprintf(stderr, "    (stack not recorded)\n");
+        }
+    }
+    if (freed) {
+        fprintf(stderr, "  freed by thread %u:\n", block->free_tid);
+        print_stack(block->free_stack);
+    }
+
+    if (symbolized) {
+        pthread_mutex_unlock(&symbolizer_lock);
+    }
+}
+
+// Release a guarded block. Freeing a block twice, or a pointer into the
+// middle of one, is reported and otherwise ignored. dealloc < 0 means the
+// block is already gone from the live table (realloc).
+static void guard_free(void *ptr, int dealloc) {
+    int was_in_tracker = in_tracker;
+    in_tracker = 1;
+    uint32_t stack = capture_stack();
+    if (!thread_tid) thread_tid = (uint32_t)syscall(SYS_gettid);
+    thread_stack_bounds();
+    guard_symbolize(stack);
+    in_tracker = was_in_tracker;
+
+    size_t page_index = ((char *)ptr - guard_pool) / guard_page_size;
+    guard_slot_t *slot = page_index % 2 ? &guard_slots[(page_index - 1) / 2] : NULL;
+
+    pthread_mutex_lock(&guard_lock);
+    if (!slot || slot->state != GUARD_LIVE || slot->block.ptr != (uintptr_t)ptr) {
+        guard_slot_t copy = slot ? *slot : (guard_slot_t){0};
+        pthread_mutex_unlock(&guard_lock);
+
+        char problem[128];
+        if (copy.state == GUARD_FREED && copy.block.ptr == (uintptr_t)ptr) {
+            snprintf(problem, sizeof(problem), "double free of %p", ptr);
+        } else {
+            snprintf(problem, sizeof(problem), "invalid free of %p, not the start of a live block", ptr);
+        }
+        in_tracker = 1;
+        report_block("GUARD", problem, stack, &copy.block, copy.state == GUARD_FREED);
+        in_tracker = was_in_tracker;
+        return;
+    }
+
+    if (dealloc >= 0) {
+        record_free(ptr, dealloc);
+    }
+    char *page = guard_slot_page((page_index - 1) / 2);
+    mprotect(page, guard_page_size, PROT_NONE);
+    madvise(page, guard_page_size, MADV_DONTNEED);
+    slot->state = GUARD_FREED;
+    slot->block.free_stack = stack;
+    slot->block.free_tid = thread_tid;
+    guard_queue[(guard_queue_head + guard_queue_count) % guard_slot_count] = (uint32_t)((page_index - 1) / 2);
+    guard_queue_count++;
+    pthread_mutex_unlock(&guard_lock);
+}
+
+// Size of a live guarded block, 0 if ptr is not the start of one
+static size_t guard_block_size(void *ptr) {
+    size_t page_index = ((char *)ptr - guard_pool) / guard_page_size;
+    if (page_index % 2 == 0) return 0;
+
+    guard_slot_t *slot = &guard_slots[(page_index - 1) / 2];
+    pthread_mutex_lock(&guard_lock);
+    size_t size = slot->state == GUARD_LIVE && slot->block.ptr == (uintptr_t)ptr ? slot->block.size : 0;
+    pthread_mutex_unlock(&guard_lock);
+    return size;
+}
+
+// A guarded block never grows in place: realloc always moves it, and the
+// old page is protected as on free
+static void *guard_realloc(void *ptr, size_t size, int api) {
+    size_t old_size = guard_block_size(ptr);
+    if (size == 0 || old_size == 0) {
+        guard_free(ptr, DEALLOC_FREE);
+        return NULL;
+    }
+
+    void *new_ptr = guard_try(size, 0);
+    if (!new_ptr) new_ptr = real_malloc(size);
+    if (!new_ptr) return NULL;
+
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    record_allocation(new_ptr, size, api, ptr, old_size);
+    guard_free(ptr, -1);
+    return new_ptr;
+}
+
+static void fault_put(fault_line_t *line, const char *text) {
+    while (*text && line->length < sizeof(line->text)) {
+        line->text[line->length++] = *text++;
+    }
+}
+
+static void fault_put_number(fault_line_t *line, uintptr_t value, int hex) {
+    char digits[24];
+    int count = 0;
+    unsigned int base = hex ? 16 : 10;
+
+    do {
+        digits[count++] = "0123456789abcdef"[value % base];
+        value /= base;
+    } while (value);
+    if (hex) fault_put(line, "0x");
+    while (count > 0 && line->length < sizeof(line->text)) {
+        line->text[line->length++] = digits[--count];
+    }
+}
+
+static void fault_flush(fault_line_t *line) {
+    size_t done = 0;
+    while (done < line->length) {
+        ssize_t n = write(STDERR_FILENO, line->text + done, line->length - done);
+        if (n <= 0) break;
+        done += (size_t)n;
+    }
+    line->length = 0;
+}
+
+// Print frames from the symbol cache when named is set (the handler holds
+// symbolizer_lock), falling back to module offsets from the map ranges
+// already built and then to raw addresses
+static void fault_put_frames(fault_line_t *line, void *const *frames, uint32_t depth, int named) {
+    for (uint32_t j = 0; j < depth; j++) {
+        uintptr_t addr = (uintptr_t)frames[j];
+        symbol_slot_t *slot = named && symbol_cache ? symbol_cache_slot(addr) : NULL;
+        map_range_t *range = named ? find_map_range(addr) : NULL;
+        fault_put(line, "    ");
+        if (slot && slot->addr) {
+            fault_put(line, slot->text);
+        } else if (range) {
+            fault_put(line, range->path);
+            fault_put(line, "(+");
+            fault_put_number(line, addr - range->bias, 1);
+            fault_put(line, ") [");
+            fault_put_number(line, addr, 1);
+            fault_put(line, "]");
+        } else {
+            fault_put(line, "[");
+            fault_put_number(line, addr, 1);
+            fault_put(line, "]");
+        }
+        fault_put(line, "\n");
+        fault_flush(line);
+    }
+}
+
+// Describe a fault inside the pool: inside a freed slot it is use after
+// free, on a guard page it is an overflow of the nearer neighbouring block
+static void guard_describe_fault(char *addr, const char *access, guard_slot_t *found,
+                                 fault_line_t *line) {
+    size_t page_index = (addr - guard_pool) / guard_page_size;
+
+    memset(found, 0, sizeof(*found));
+    if (page_index % 2) {
+        *found = guard_slots[(page_index - 1) / 2];
+        if (found->state == GUARD_FREED) {
+            long offset = (long)((uintptr_t)addr - found->block.ptr);
+            fault_put(line, "use-after-free ");
+            fault_put(line, access);
+            fault_put(line, " at ");
+            fault_put_number(line, (uintptr_t)addr, 1);
+            fault_put(line, " (");
+            fault_put_number(line, (uintptr_t)labs(offset), 0);
+            fault_put(line, offset < 0 ? " bytes before the block)" : " bytes into the block)");
+        } else {
+            fault_put(line, access);
+            fault_put(line, " of unused guard slot memory at ");
+            fault_put_number(line, (uintptr_t)addr, 1);
+        }
+        return;
+    }
+
+    // Guard page g lies between slots g - 1 and g
+    size_t guard = page_index / 2;
+    guard_slot_t *left = guard > 0 ? &guard_slots[guard - 1] : NULL;
+    guard_slot_t *right = guard < guard_slot_count ? &guard_slots[guard] : NULL;
+    if (left && left->state == GUARD_UNUSED) left = NULL;
+    if (right && right->state == GUARD_UNUSED) right = NULL;
+
+    uintptr_t past_end = left ? (uintptr_t)addr - (left->block.ptr + left->block.size) : 0;
+    uintptr_t before_start = right ? right->block.ptr - (uintptr_t)addr : 0;
+    if (left && (!right || past_end <= before_start)) {
+        *found = *left;
+        fault_put(line, "heap-buffer-overflow ");
+        fault_put(line, access);
+        fault_put(line, " at ");
+        fault_put_number(line, (uintptr_t)addr, 1);
+        fault_put(line, " (");
+        fault_put_number(line, past_end, 0);
+        fault_put(line, " bytes past the end");
+    } else if (right) {
+        *found = *right;
+        fault_put(line, "heap-buffer-underflow ");
+        fault_put(line, access);
+        fault_put(line, " at ");
+        fault_put_number(line, (uintptr_t)addr, 1);
+        fault_put(line, " (");
+        fault_put_number(line, before_start, 0);
+        fault_put(line, " bytes before the start");
+    } else {
+        fault_put(line, access);
+        fault_put(line, " of a guard page at ");
+        fault_put_number(line, (uintptr_t)addr, 1);
+        return;
+    }
+    fault_put(line, found->state == GUARD_FREED ? " of a freed block)" : ")");
+}
+
+// Report a fault in the pool in the same layout as report_block, using only
+// async-signal-safe steps: the stack is unwound from the signal context
+// into a local buffer, and block stacks are named from the symbol cache
+// they were resolved into when the block was allocated and freed
+static void guard_fault(int sig, siginfo_t *info, void *context) {
+    int was_in_tracker = in_tracker;
+
+    if (is_guarded(info->si_addr)) {
+#if defined(__x86_64__)
+        // Page fault error code: bit 1 is set for writes
+        const char *access = ((ucontext_t *)context)->uc_mcontext.gregs[REG_ERR] & 2 ? "WRITE" : "READ";
+#else
+        const char *access = "access";
+#endif
+        void *frames[MAX_BACKTRACE];
+        fault_line_t line;
+        guard_slot_t slot;
+
+        in_tracker = 1;
+        int depth = unwind_context(context, frames, MAX_BACKTRACE);
+        // The cache is only read, and only while no report is rebuilding it
+        int named = pthread_mutex_trylock(&symbolizer_lock) == 0;
+
+        line.length = 0;
+        fault_put(&line, "\nMemory Tracker: GUARD - ");
+        guard_describe_fault(info->si_addr, access, &slot, &line);
+        fault_put(&line, "\n  at:\n");
+        fault_flush(&line);
+        fault_put_frames(&line, frames, (uint32_t)depth, named);
+
+        block_history_t *block = &slot.block;
+        if (block->ptr) {
+            fault_put(&line, "  ");
+            fault_put_number(&line, block->size, 0);
+            fault_put(&line, "-byte block at ");
+            fault_put_number(&line, block->ptr, 1);
+            fault_put(&line, " allocated");
+            if (block->alloc_tid) {
+                fault_put(&line, " by thread ");
+                fault_put_number(&line, block->alloc_tid, 0);
+            }
+            fault_put(&line, ":\n");
+            if (block->alloc_stack) {
+                stack_trace_t *trace = stack_trace_get(block->alloc_stack);
+                fault_put_frames(&line, trace->frames, trace->depth, named);
+            } else {
+                fault_put(&line, "    (stack not recorded)\n");
+            }
+            fault_flush(&line);
+        }
+        if (slot.state == GUARD_FREED) {
+            fault_put(&line, "  freed by thread ");
+            fault_put_number(&line, block->free_tid, 0);
+            fault_put(&line, ":\n");
+            fault_flush(&line);
+            if (block->free_stack) {
+                stack_trace_t *trace = stack_trace_get(block->free_stack);
+                fault_put_frames(&line, trace->frames, trace->depth, named);
+            }
+        }
+
+        if (named) {
+            pthread_mutex_unlock(&symbolizer_lock);
+        }
+        in_tracker = was_in_tracker;
+    }
+
+    // Hand the fault on; with the default action, returning re-executes
+    // the access and the process dies with SIGSEGV as it would have
+    if (guard_previous_segv.sa_flags & SA_SIGINFO) {
+        guard_previous_segv.sa_sigaction(sig, info, context);
+    } else if (guard_previous_segv.sa_handler == SIG_DFL || guard_previous_segv.sa_handler == SIG_IGN) {
+        sigaction(SIGSEGV, &guard_previous_segv, NULL);
+    } else {
+        guard_previous_segv.sa_handler(sig);
+    }
+}
+
+// Reserve the pool and install the fault handler. Pool pages cost nothing
+// until a slot is used.
+static void init_guard(unsigned long rate) {
+    unsigned long slots = GUARD_DEFAULT_SLOTS;
+    char *env = getenv("MEMTRACK_GUARD_SLOTS");
+    if (env && *env && strtoul(env, NULL, 10) > 0) {
+        slots = strtoul(env, NULL, 10);
+        if (slots > GUARD_MAX_SLOTS) slots = GUARD_MAX_SLOTS;
+    }
 
-typedef struct allocation {
-    void *ptr;
-    size_t size;
-    void *backtrace[MAX_BACKTRACE];
-    int backtrace_size;
-    time_t timestamp;
-    struct allocation *next;
-} allocation_t;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t pool_size = (2 * slots + 1) * page;
+    char *pool = mmap(NULL, pool_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    void *meta = mmap(NULL, (sizeof(guard_slot_t) + sizeof(uint32_t)) * slots, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pool == MAP_FAILED || meta == MAP_FAILED) {
+        fprintf(stderr, "Memory Tracker: Failed to reserve the guard pool\n");
+        return;
+    }
 
-typedef struct {
-    allocation_t *table[HASH_SIZE];
-    pthread_mutex_t mutex;
-    size_t total_allocated;
-    size_t total_freed;
-    size_t peak_usage;
-    size_t current_usage;
-    int allocation_count;
-    int free_count;
-} memory_tracker_t;
+    guard_slots = meta;
+    guard_queue = (uint32_t *)(guard_slots + slots);
+    for (unsigned long i = 0; i < slots; i++) {
+        guard_queue[i] = (uint32_t)i;
+    }
+    guard_queue_count = (unsigned int)slots;
+    guard_slot_count = (unsigned int)slots;
+    guard_page_size = page;
+    guard_rate = rate;
 
-static memory_tracker_t tracker = {0};
-static int initialized = 0;
-static int tracking_enabled = 1;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = guard_fault;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGSEGV, &action, &guard_previous_segv) != 0) {
+        fprintf(stderr, "Memory Tracker: Failed to install the guard fault handler\n");
+        return;
+    }
 
-// Function pointers for original malloc/free
-static void* (*real_malloc)(size_t size) = NULL;
-static void (*real_free)(void *ptr) = NULL;
-static void* (*real_calloc)(size_t nmemb, size_t size) = NULL;
-static void* (*real_realloc)(void *ptr, size_t size) = NULL;
+    guard_pool_end = pool + pool_size;
+    guard_pool = pool;
+}
+
+// Free quarantine, after ASan. A freed block is filled with
+// QUARANTINE_POISON and held back from malloc, oldest first out, while the
+// held bytes fit in MEMTRACK_QUARANTINE. A second free of a held block is
+// reported with its allocation and first free; a block whose poison changed
+// by the time it leaves was written after it was freed. Only the first
+// MEMTRACK_QUARANTINE_POISON bytes of each block are filled and checked,
+// which bounds the CPU spent per free.
 
-// Hash function for allocation tracking
-static unsigned int hash_ptr(void *ptr) {
-    uintptr_t addr = (uintptr_t)ptr;
-    return (addr >> 3) % HASH_SIZE;
+// Look ptr up in the live table and return 1 with its allocation stack in
+// *stack_id if it is the start of a live block, 0 otherwise
+static int find_live_block(void *ptr, uint32_t *stack_id) {
+    tracker_shard_t *shard = shard_for(ptr);
+    table_slot_t *slot = NULL;
+
+    pthread_mutex_lock(&shard->mutex);
+    long i = slot_table_find(&shard->table, (uintptr_t)ptr);
+    if (i < 0 && shard->old_table.slots) {
+        i = slot_table_find(&shard->old_table, (uintptr_t)ptr);
+        if (i >= 0) slot = &shard->old_table.slots[i];
+    } else if (i >= 0) {
+        slot = &shard->table.slots[i];
+    }
+    if (slot) {
+        *stack_id = aggregate_mode ? (uint32_t)(slot->block & ((1u << BLOCK_ID_BITS) - 1))
+                                   : slot->alloc->stack_id;
+    }
+    pthread_mutex_unlock(&shard->mutex);
+    return slot != NULL;
 }
 
-// Initialize the tracker
-static void init_tracker() {
-    if (initialized) return;
-    
-    // Get real function pointers
-    real_malloc = dlsym(RTLD_NEXT, "malloc");
-    real_free = dlsym(RTLD_NEXT, "free");
-    real_calloc = dlsym(RTLD_NEXT, "calloc");
-    real_realloc = dlsym(RTLD_NEXT, "realloc");
-    
-    if (!real_malloc || !real_free || !real_calloc || !real_realloc) {
-        fprintf(stderr, "Memory Tracker: Failed to get real function pointers\n");
-        return;
+// Offset of the first byte that lost its poison, or -1 if it is intact
+static long quarantine_damage(const quarantine_entry_t *entry) {
+    const unsigned char *bytes = (const unsigned char *)entry->block.ptr;
+    for (size_t i = 0; i < entry->poisoned; i++) {
+        if (bytes[i] != QUARANTINE_POISON) return (long)i;
     }
-    
-    pthread_mutex_init(&tracker.mutex, NULL);
-    initialized = 1;
-    
-    // Register signal handler for leak report
-    signal(SIGTERM, NULL);
-    signal(SIGINT, NULL);
-    
-    // Check if we should enable tracking
-    char *env = getenv("MEMTRACK_ENABLE");
-    if (env && strcmp(env, "0") == 0) {
-        tracking_enabled = 0;
+    return -1;
+}
+
+// Report a held block whose poison was overwritten (caller holds
+// quarantine_lock and sets in_tracker)
+static void quarantine_check(const quarantine_entry_t *entry) {
+    long offset = quarantine_damage(entry);
+    if (offset < 0) return;
+
+    char problem[128];
+    snprintf(problem, sizeof(problem), "write after free at offset %ld of %p",
+             offset, (void *)entry->block.ptr);
+    report_block("QUARANTINE", problem, 0, &entry->block, 1);
+    __atomic_add_fetch(&quarantine_errors, 1, __ATOMIC_RELAXED);
+}
+
+// Copy of the entry holding ptr; 0 if ptr is not held
+static int quarantine_lookup(void *ptr, quarantine_entry_t *entry) {
+    pthread_mutex_lock(&quarantine_lock);
+    long i = slot_table_find(&quarantine_index, (uintptr_t)ptr);
+    if (i >= 0) {
+        *entry = quarantine_ring[quarantine_index.slots[i].block];
     }
-    
-    fprintf(stderr, "Memory Tracker: Initialized (PID: %d)\n", getpid());
+    pthread_mutex_unlock(&quarantine_lock);
+    return i >= 0;
 }
 
-// Add allocation to tracker
-static void track_allocation(void *ptr, size_t size) {
-    if (!tracking_enabled || !initialized) return;
-    
-    allocation_t *alloc = real_malloc(sizeof(allocation_t));
-    if (!alloc) return;
-    
-    alloc->ptr = ptr;
-    alloc->size = size;
-    alloc->timestamp = time(NULL);
-    alloc->backtrace_size = backtrace(alloc->backtrace, MAX_BACKTRACE);
-    
-    pthread_mutex_lock(&tracker.mutex);
-    
-    unsigned int index = hash_ptr(ptr);
-    alloc->next = tracker.table[index];
-    tracker.table[index] = alloc;
-    
-    tracker.total_allocated += size;
-    tracker.current_usage += size;
-    tracker.allocation_count++;
-    
-    if (tracker.current_usage > tracker.peak_usage) {
-        tracker.peak_usage = tracker.current_usage;
-    }
-    
-    pthread_mutex_unlock(&tracker.mutex);
+// Hand the oldest block back to malloc after checking its poison (caller
+// holds quarantine_lock)
+static void quarantine_evict(void) {
+    quarantine_entry_t *entry = &quarantine_ring[quarantine_head];
+    long i = slot_table_find(&quarantine_index, entry->block.ptr);
+    if (i >= 0) slot_table_erase(&quarantine_index, (size_t)i);
+
+    int was_in_tracker = in_tracker;
+    in_tracker = 1;
+    quarantine_check(entry);
+    in_tracker = was_in_tracker;
+
+    real_free((void *)entry->block.ptr);
+    quarantine_bytes -= entry->block.size;
+    quarantine_head = (quarantine_head + 1) & (quarantine_capacity - 1);
+    quarantine_count--;
+    quarantine_evicted++;
 }
 
-// Remove allocation from tracker
-static void untrack_allocation(void *ptr) {
-    if (!tracking_enabled || !initialized || !ptr) return;
-    
-    pthread_mutex_lock(&tracker.mutex);
-    
-    unsigned int index = hash_ptr(ptr);
-    allocation_t **current = &tracker.table[index];
-    
-    while (*current) {
-        if ((*current)->ptr == ptr) {
-            allocation_t *to_remove = *current;
-            *current = (*current)->next;
-            
-            tracker.total_freed += to_remove->size;
-            tracker.current_usage -= to_remove->size;
-            tracker.free_count++;
-            
-            real_free(to_remove);
-            pthread_mutex_unlock(&tracker.mutex);
-            return;
+// Free through the quarantine instead of straight to malloc
+static void quarantine_free(void *ptr, int dealloc) {
+    int was_in_tracker = in_tracker;
+    in_tracker = 1;
+    uint32_t stack = capture_stack();
+    if (!thread_tid) thread_tid = (uint32_t)syscall(SYS_gettid);
+    in_tracker = was_in_tracker;
+
+    quarantine_entry_t held;
+    if (quarantine_lookup(ptr, &held)) {
+        char problem[64];
+        snprintf(problem, sizeof(problem), "double free of %p", ptr);
+        in_tracker = 1;
+        report_block("QUARANTINE", problem, stack, &held.block, 1);
+        in_tracker = was_in_tracker;
+        __atomic_add_fetch(&quarantine_errors, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    // Only blocks in the live table are held. A block allocated while
+    // tracking was off is passed straight through; any other pointer is not
+    // a block at all, so it is reported and handed to free() untouched for
+    // the allocator to reject.
+    uint32_t alloc_stack = 0;
+    int live = find_live_block(ptr, &alloc_stack);
+    if (!live && buffered_mode) {
+        drain_rings(0);
+        live = find_live_block(ptr, &alloc_stack);
+    }
+    if (!live) {
+        if (__atomic_load_n(&tracking_enabled, __ATOMIC_RELAXED) &&
+            !__atomic_load_n(&tracking_restarted, __ATOMIC_RELAXED)) {
+            char problem[64];
+            snprintf(problem, sizeof(problem), "invalid free of %p", ptr);
+            block_history_t none = { 0 };
+            in_tracker = 1;
+            report_block("QUARANTINE", problem, stack, &none, 0);
+            in_tracker = was_in_tracker;
+            __atomic_add_fetch(&quarantine_errors, 1, __ATOMIC_RELAXED);
         }
-        current = &(*current)->next;
+        real_free(ptr);
+        return;
+    }
+
+    // Too big to hold: it would push everything else out
+    size_t size = real_malloc_usable_size(ptr);
+    if (size > quarantine_budget / 4) {
+        record_free(ptr, dealloc);
+        real_free(ptr);
+        return;
+    }
+
+    quarantine_entry_t entry;
+    entry.block.ptr = (uintptr_t)ptr;
+    entry.block.size = size;
+    entry.block.alloc_stack = alloc_stack;
+    entry.block.alloc_tid = 0;
+    entry.block.free_stack = stack;
+    entry.block.free_tid = thread_tid;
+    entry.poisoned = size < quarantine_poison ? size : quarantine_poison;
+    record_free(ptr, dealloc);
+    memset(ptr, QUARANTINE_POISON, entry.poisoned);
+
+    pthread_mutex_lock(&quarantine_lock);
+    while (quarantine_count == quarantine_capacity ||
+           (quarantine_count && quarantine_bytes + size > quarantine_budget)) {
+        quarantine_evict();
     }
-    
-    pthread_mutex_unlock(&tracker.mutex);
-    fprintf(stderr, "Memory Tracker: WARNING - Free of untracked pointer %p\n", ptr);
+    size_t position = (quarantine_head + quarantine_count) & (quarantine_capacity - 1);
+    quarantine_ring[position] = entry;
+    slot_table_put(&quarantine_index, (table_slot_t){ .ptr = (uintptr_t)ptr, .block = position });
+    quarantine_count++;
+    quarantine_bytes += size;
+    pthread_mutex_unlock(&quarantine_lock);
 }
 
-// Print leak report
-void print_leak_report() {
+// realloc of a held block: report it and fail the call, leaving the block held
+static void quarantine_realloc(void *ptr, const quarantine_entry_t *held) {
+    int was_in_tracker = in_tracker;
+    in_tracker = 1;
+    char problem[64];
+    snprintf(problem, sizeof(problem), "realloc of freed block %p", ptr);
+    report_block("QUARANTINE", problem, capture_stack(), &held->block, 1);
+    in_tracker = was_in_tracker;
+    __atomic_add_fetch(&quarantine_errors, 1, __ATOMIC_RELAXED);
+}
+
+// Check every block still held, at exit
+static void quarantine_check_all(void) {
+    in_tracker = 1;
+    pthread_mutex_lock(&quarantine_lock);
+    for (size_t n = 0; n < quarantine_count; n++) {
+        quarantine_check(&quarantine_ring[(quarantine_head + n) & (quarantine_capacity - 1)]);
+    }
+    pthread_mutex_unlock(&quarantine_lock);
+    in_tracker = 0;
+}
+
+// Size the ring and index for the byte budget: room for one block per 16
+// bytes of budget, within [QUARANTINE_MIN_BLOCKS, QUARANTINE_MAX_BLOCKS]
+static void init_quarantine(size_t budget) {
+    if (!real_malloc_usable_size) {
+        fprintf(stderr, "Memory Tracker: Quarantine needs malloc_usable_size\n");
+        return;
+    }
+
+    size_t capacity = QUARANTINE_MIN_BLOCKS;
+    while (capacity < QUARANTINE_MAX_BLOCKS && capacity * 16 < budget) {
+        capacity *= 2;
+    }
+    void *ring = mmap(NULL, sizeof(quarantine_entry_t) * capacity, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED || slot_table_init(&quarantine_index, capacity * 2) != 0) {
+        fprintf(stderr, "Memory Tracker: Failed to reserve the quarantine\n");
+        if (ring != MAP_FAILED) munmap(ring, sizeof(quarantine_entry_t) * capacity);
+        return;
+    }
+
+    char *env = getenv("MEMTRACK_QUARANTINE_POISON");
+    if (env && *env) {
+        quarantine_poison = strtoul(env, NULL, 10);
+    }
+    quarantine_ring = ring;
+    quarantine_capacity = capacity;
+    quarantine_budget = budget;
+}
+
+// Fork handling. fork_prepare takes every tracker lock in the order the
+// tracker nests them, so no other thread is halfway through an update when
+// the address space is copied, and the parent just releases them again.
+// The child starts with one thread and a copy of everything. It keeps the
+// stack table and symbol caches, which stay shared copy-on-write, and sheds
+// the parent's live blocks, counters, buffered events and metadata slabs by
+// discarding or unmapping pages rather than writing to them.
+static void fork_lock_all(void) {
+    pthread_mutex_lock(&control_lock);
+    pthread_mutex_lock(&snapshot_lock);
+    pthread_mutex_lock(&guard_lock);
+    pthread_mutex_lock(&drain_mutex);
+    lock_all_shards();
+    pthread_mutex_lock(&stack_table.lock);
+    pthread_mutex_lock(&record_cache.lock);
+    pthread_mutex_lock(&pending_cache.lock);
+    pthread_mutex_lock(&trace_lock);
+    pthread_mutex_lock(&quarantine_lock);
+    pthread_mutex_lock(&symbolizer_lock);
+}
+
+static void fork_unlock_all(void) {
+    pthread_mutex_unlock(&symbolizer_lock);
+    pthread_mutex_unlock(&quarantine_lock);
+    pthread_mutex_unlock(&trace_lock);
+    pthread_mutex_unlock(&pending_cache.lock);
+    pthread_mutex_unlock(&record_cache.lock);
+    pthread_mutex_unlock(&stack_table.lock);
+    unlock_all_shards();
+    pthread_mutex_unlock(&drain_mutex);
+    pthread_mutex_unlock(&guard_lock);
+    pthread_mutex_unlock(&snapshot_lock);
+    pthread_mutex_unlock(&control_lock);
+}
+
+static void fork_prepare(void) {
     if (!initialized) return;
-    
-    pthread_mutex_lock(&tracker.mutex);
-    
-    fprintf(stderr, "\n=== MEMORY LEAK REPORT ===\n");
-    fprintf(stderr, "Total allocated: %zu bytes (%d allocations)\n", 
-            tracker.total_allocated, tracker.allocation_count);
-    fprintf(stderr, "Total freed: %zu bytes (%d frees)\n", 
-            tracker.total_freed, tracker.free_count);
-    fprintf(stderr, "Current usage: %zu bytes\n", tracker.current_usage);
-    fprintf(stderr, "Peak usage: %zu bytes\n", tracker.peak_usage);
-    
-    if (tracker.current_usage > 0) {
-        fprintf(stderr, "\nLEAKED ALLOCATIONS:\n");
-        
-        for (int i = 0; i < HASH_SIZE; i++) {
-            allocation_t *alloc = tracker.table[i];
-            while (alloc) {
-                fprintf(stderr, "  LEAK: %zu bytes at %p (allocated at %s", 
-                        alloc->size, alloc->ptr, ctime(&alloc->timestamp));
-                
-                // Print backtrace
-                char **symbols = backtrace_symbols(alloc->backtrace, alloc->backtrace_size);
-                if (symbols) {
-                    for (int j = 0; j < alloc->backtrace_size; j++) {
-                        fprintf(stderr, "    %s\n", symbols[j]);
-                    }
-                    free(symbols);
-                }
-                alloc = alloc->next;
-            }
+    fork_lock_all();
+    fork_locked = 1;
+}
+
+static void fork_parent(void) {
+    if (!fork_locked) return;
+    fork_locked = 0;
+    fork_unlock_all();
+}
+
+static void fork_child(void) {
+    if (!fork_locked) return;
+    fork_locked = 0;
+
+    int was_in_tracker = in_tracker;
+    in_tracker = 1;
+
+    // The forking thread is the only one left, with a new tid
+    thread_tid = 0;
+    thread_index = 0;
+    thread_index_count = 0;
+    if (thread_index_tids) {
+        madvise(thread_index_tids, sizeof(uint32_t) * (THREAD_INDEX_OVERFLOW + 1), MADV_DONTNEED);
+    }
+    aggregator_running = 0;
+    aggregator_stop = 0;
+    snapshot_running = 0;
+    snapshot_stop = 0;
+    stats_running = 0;
+    stats_stop = 0;
+    pthread_cond_init(&snapshot_wake, NULL);
+
+    // Buffered events are the parent's, and rings of threads that did not
+    // survive the fork are free for reuse
+    for (event_ring_t *ring = ring_list; ring; ring = ring->next) {
+        ring->tail = ring->head;
+        ring->stalled_passes = 0;
+        if (ring != thread_ring) ring->orphaned = 1;
+    }
+    memset(pending_frees, 0, sizeof(pending_frees));
+
+    // Only the forking thread's stack is left to scan
+    if (reach_threads) {
+        for (int i = 0; i < REACH_MAX_THREADS; i++) {
+            if (&reach_threads[i] != thread_reach) reach_threads[i].used = 0;
         }
-    } else {
-        fprintf(stderr, "No memory leaks detected!\n");
+        reach_threads_missed = 0;
+    }
+
+    // Blocks the parent allocated are freed unseen from here on
+    tracking_restarted = 1;
+    guard_sampled = 0;
+    slab_drop_all(&record_cache);
+    slab_drop_all(&pending_cache);
+    clear_tracking_state();
+
+    // The trace file, stats page and control channel belong to the parent
+    if (trace_fd >= 0) {
+        if (trace_end) munmap(trace_end - TRACE_CHUNK_RECORDS, TRACE_CHUNK_BYTES);
+        trace_pos = trace_end = NULL;
+        munmap(trace_header, TRACE_HEADER_SIZE);
+        trace_header = NULL;
+        close(trace_fd);
+        trace_fd = -1;
+        trace_spare_count = 0;
+    }
+    if (stats_page) {
+        munmap(stats_page, STATS_PAGE_SIZE);
+        stats_page = NULL;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (control_pipe[i] >= 0) close(control_pipe[i]);
+        control_pipe[i] = -1;
+    }
+    if (control_socket >= 0) {
+        close(control_socket);
+        control_socket = -1;
+    }
+    control_path = NULL;
+
+    fork_child_pending = 1;
+    fork_unlock_all();
+    in_tracker = was_in_tracker;
+
+    // With tracking off no tracked call comes along, yet the control
+    // channel is how it gets switched on
+    if (!tracking_enabled && control_spec) {
+        finish_fork_child();
+    }
+}
+
+// Output name for a forked child: the configured path tagged with its pid
+static void child_output_path(char *buffer, size_t size, const char *path) {
+    snprintf(buffer, size, "%s.%d", path, getpid());
+}
+
+// First tracked call in a forked child: open the child's own trace, stats
+// page and control channel, and restart the helper threads. Deferring this
+// means a child that only execs leaves no files behind.
+static void finish_fork_child(void) {
+    if (!__atomic_exchange_n(&fork_child_pending, 0, __ATOMIC_ACQ_REL)) return;
+
+    char path[256];
+    in_tracker = 1;
+    if (trace_path) {
+        child_output_path(path, sizeof(path), trace_path);
+        init_trace(path);
+    }
+    if (stats_spec) {
+        if (strcmp(stats_spec, "1") == 0) {
+            init_stats(NULL);
+        } else {
+            child_output_path(path, sizeof(path), stats_spec);
+            init_stats(path);
+        }
+    }
+    if (collapsed_spec) {
+        child_output_path(collapsed_path, sizeof(collapsed_path), collapsed_spec);
+    }
+    if (pprof_spec) {
+        child_output_path(pprof_path, sizeof(pprof_path), pprof_spec);
+    }
+    in_tracker = 0;
+
+    if (buffered_mode) {
+        start_aggregator();
+    }
+    if (snapshot_interval) {
+        start_snapshots();
+    }
+    if (stats_page) {
+        start_stats();
+    }
+    if (control_spec && strcmp(control_spec, "signals") == 0) {
+        start_control(control_spec);
+    } else if (control_spec) {
+        child_output_path(child_control_path, sizeof(child_control_path), control_spec);
+        start_control(child_control_path);
     }
-    
-    fprintf(stderr, "=========================\n\n");
-    pthread_mutex_unlock(&tracker.mutex);
 }
 
 // Intercepted malloc
 void* malloc(size_t size) {
-    if (!initialized) init_tracker();
-    
-    void *ptr = real_malloc(size);
+    void *ptr = guard_try(size, 0);
+    if (!ptr) ptr = real_malloc(size);
     if (ptr) {
-        track_allocation(ptr, size);
+        record_allocation(ptr, size, API_MALLOC, NULL, 0);
     }
     return ptr;
 }
 
 // Intercepted free
 void free(void *ptr) {
-    if (!initialized) init_tracker();
-    
-    if (ptr) {
-        untrack_allocation(ptr);
+    // Bootstrap arena blocks are never released
+    if (ptr && is_guarded(ptr)) {
+        guard_free(ptr, DEALLOC_FREE);
+    } else if (ptr && !is_bootstrap(ptr)) {
+        if (quarantine_budget && !in_tracker) {
+            quarantine_free(ptr, DEALLOC_FREE);
+            return;
+        }
+        record_free(ptr, DEALLOC_FREE);
         real_free(ptr);
     }
 }
 
 // Intercepted calloc
 void* calloc(size_t nmemb, size_t size) {
-    if (!initialized) init_tracker();
-    
-    void *ptr = real_calloc(nmemb, size);
+    // Guarded pages are zero: fresh, or discarded when last freed
+    size_t bytes;
+    void *ptr = __builtin_mul_overflow(nmemb, size, &bytes) ? NULL : guard_try(bytes, 0);
+    if (!ptr) ptr = real_calloc(nmemb, size);
     if (ptr) {
-        track_allocation(ptr, nmemb * size);
+        record_allocation(ptr, nmemb * size, API_CALLOC, NULL, 0);
     }
     return ptr;
 }
 
-// Intercepted realloc
-void* realloc(void *ptr, size_t size) {
-    if (!initialized) init_tracker();
-    
+// Shared by realloc and reallocarray
+static void *reallocate(void *ptr, size_t size, int api) {
     if (!ptr) {
         // realloc(NULL, size) is equivalent to malloc(size)
+        void *new_ptr = guard_try(size, 0);
+        if (!new_ptr) new_ptr = real_malloc(size);
+        if (new_ptr) {
+            record_allocation(new_ptr, size, api, NULL, 0);
+        }
+        return new_ptr;
+    }
+
+    if (is_bootstrap(ptr)) {
+        // Move the block out of the bootstrap arena
         void *new_ptr = real_malloc(size);
         if (new_ptr) {
-            track_allocation(new_ptr, size);
+            size_t old_size = bootstrap_size(ptr);
+            memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+            record_allocation(new_ptr, size, api, NULL, 0);
         }
         return new_ptr;
     }
-    
+
+    if (is_guarded(ptr)) {
+        return guard_realloc(ptr, size, api);
+    }
+
+    quarantine_entry_t held;
+    if (quarantine_budget && !in_tracker && quarantine_lookup(ptr, &held)) {
+        quarantine_realloc(ptr, &held);
+        return NULL;
+    }
+
     if (size == 0) {
         // realloc(ptr, 0) is equivalent to free(ptr)
-        untrack_allocation(ptr);
+        if (quarantine_budget && !in_tracker) {
+            quarantine_free(ptr, DEALLOC_FREE);
+            return NULL;
+        }
+        record_free(ptr, DEALLOC_FREE);
         real_free(ptr);
         return NULL;
     }
-    
+
+    // The old block's usable size is what a move has to copy
+    size_t old_size = realloc_mode && real_malloc_usable_size ? real_malloc_usable_size(ptr) : 0;
     void *new_ptr = real_realloc(ptr, size);
     if (new_ptr) {
-        untrack_allocation(ptr);
-        track_allocation(new_ptr, size);
+        record_allocation(new_ptr, size, api, ptr, old_size);
     }
     return new_ptr;
 }
 
+// Intercepted realloc
+void* realloc(void *ptr, size_t size) {
+    return reallocate(ptr, size, API_REALLOC);
+}
+
+// Intercepted reallocarray. glibc's version calls realloc through the PLT,
+// which would record the block twice, so it is rebuilt on real_realloc.
+void* reallocarray(void *ptr, size_t nmemb, size_t size) {
+    size_t bytes;
+    if (__builtin_mul_overflow(nmemb, size, &bytes)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return reallocate(ptr, bytes, API_REALLOCARRAY);
+}
+
+// Intercepted posix_memalign
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (!real_posix_memalign) return ENOMEM;
+
+    int result = real_posix_memalign(memptr, alignment, size);
+    if (result == 0) {
+        record_allocation(*memptr, size, API_POSIX_MEMALIGN, NULL, 0);
+    }
+    return result;
+}
+
+// Intercepted aligned_alloc
+void* aligned_alloc(size_t alignment, size_t size) {
+    if (!real_aligned_alloc) return NULL;
+
+    void *ptr = real_aligned_alloc(alignment, size);
+    if (ptr) {
+        record_allocation(ptr, size, API_ALIGNED_ALLOC, NULL, 0);
+    }
+    return ptr;
+}
+
+// Intercepted memalign
+void* memalign(size_t alignment, size_t size) {
+    if (!real_memalign) return NULL;
+
+    void *ptr = real_memalign(alignment, size);
+    if (ptr) {
+        record_allocation(ptr, size, API_MEMALIGN, NULL, 0);
+    }
+    return ptr;
+}
+
+// Intercepted valloc
+void* valloc(size_t size) {
+    if (!real_valloc) return NULL;
+
+    void *ptr = real_valloc(size);
+    if (ptr) {
+        record_allocation(ptr, size, API_VALLOC, NULL, 0);
+    }
+    return ptr;
+}
+
+// Intercepted pvalloc
+void* pvalloc(size_t size) {
+    if (!real_pvalloc) return NULL;
+
+    void *ptr = real_pvalloc(size);
+    if (ptr) {
+        record_allocation(ptr, size, API_PVALLOC, NULL, 0);
+    }
+    return ptr;
+}
+
+// Intercepted malloc_usable_size: not an allocation, forwarded so callers
+// see the same answer whichever library resolves the symbol
+size_t malloc_usable_size(void *ptr) {
+    if (ptr && is_bootstrap(ptr)) return bootstrap_size(ptr);
+    if (ptr && is_guarded(ptr)) return guard_block_size(ptr);
+    return real_malloc_usable_size ? real_malloc_usable_size(ptr) : 0;
+}
+
+// C++ operators, exported under their Itanium ABI names. The fast path
+// goes straight to the C allocator, which is what libstdc++ does too.
+
+// Out-of-memory path of operator new: call the C++ runtime's own operator
+// so the new_handler runs and std::bad_alloc is thrown as usual. Its
+// allocation went through our malloc or aligned_alloc, so it is recorded
+// again under the operator's API.
+static void *cxx_new_slow(const char *symbol, size_t size, size_t alignment,
+                          int aligned, int api, const void *nothrow) {
+    void *fn = dlsym(RTLD_NEXT, symbol);
+    void *ptr;
+
+    if (!fn) return NULL;
+    if (aligned) {
+        ptr = nothrow ? ((void *(*)(size_t, size_t, const void *))fn)(size, alignment, nothrow)
+                      : ((void *(*)(size_t, size_t))fn)(size, alignment);
+    } else {
+        ptr = nothrow ? ((void *(*)(size_t, const void *))fn)(size, nothrow)
+                      : ((void *(*)(size_t))fn)(size);
+    }
+    if (ptr) {
+        record_free(ptr, DEALLOC_FREE);
+        record_allocation(ptr, size, api, NULL, 0);
+    }
+    return ptr;
+}
+
+static void *cxx_new(const char *symbol, size_t size, int api, const void *nothrow) {
+    void *ptr = guard_try(size, 0);
+    if (!ptr) ptr = real_malloc(size);
+    if (!ptr) return cxx_new_slow(symbol, size, 0, 0, api, nothrow);
+
+    record_allocation(ptr, size, api, NULL, 0);
+    return ptr;
+}
+
+static void *cxx_new_aligned(const char *symbol, size_t size, size_t alignment,
+                             int api, const void *nothrow) {
+    void *ptr = real_memalign ? real_memalign(alignment, size) : NULL;
+    if (!ptr) return cxx_new_slow(symbol, size, alignment, 1, api, nothrow);
+
+    record_allocation(ptr, size, api, NULL, 0);
+    return ptr;
+}
+
+// libstdc++'s operator delete variants all end in free()
+static void cxx_delete(void *ptr, int dealloc) {
+    if (ptr && is_guarded(ptr)) {
+        guard_free(ptr, dealloc);
+    } else if (ptr && !is_bootstrap(ptr)) {
+        if (quarantine_budget && !in_tracker) {
+            quarantine_free(ptr, dealloc);
+            return;
+        }
+        record_free(ptr, dealloc);
+        real_free(ptr);
+    }
+}
+
+// operator new(size_t)
+void *_Znwm(size_t size) {
+    return cxx_new("_Znwm", size, API_NEW, NULL);
+}
+
+// operator new[](size_t)
+void *_Znam(size_t size) {
+    return cxx_new("_Znam", size, API_NEW_ARRAY, NULL);
+}
+
+// operator new(size_t, const std::nothrow_t &)
+void *_ZnwmRKSt9nothrow_t(size_t size, const void *nothrow) {
+    return cxx_new("_ZnwmRKSt9nothrow_t", size, API_NEW, nothrow);
+}
+
+// operator new[](size_t, const std::nothrow_t &)
+void *_ZnamRKSt9nothrow_t(size_t size, const void *nothrow) {
+    return cxx_new("_ZnamRKSt9nothrow_t", size, API_NEW_ARRAY, nothrow);
+}
+
+// operator new(size_t, std::align_val_t)
+void *_ZnwmSt11align_val_t(size_t size, size_t alignment) {
+    return cxx_new_aligned("_ZnwmSt11align_val_t", size, alignment, API_NEW_ALIGNED, NULL);
+}
+
+// operator new[](size_t, std::align_val_t)
+void *_ZnamSt11align_val_t(size_t size, size_t alignment) {
+    return cxx_new_aligned("_ZnamSt11align_val_t", size, alignment, API_NEW_ARRAY_ALIGNED, NULL);
+}
+
+// operator new(size_t, std::align_val_t, const std::nothrow_t &)
+void *_ZnwmSt11align_val_tRKSt9nothrow_t(size_t size, size_t alignment, const void *nothrow) {
+    return cxx_new_aligned("_ZnwmSt11align_val_tRKSt9nothrow_t", size, alignment,
+                           API_NEW_ALIGNED, nothrow);
+}
+
+// operator new[](size_t, std::align_val_t, const std::nothrow_t &)
+void *_ZnamSt11align_val_tRKSt9nothrow_t(size_t size, size_t alignment, const void *nothrow) {
+    return cxx_new_aligned("_ZnamSt11align_val_tRKSt9nothrow_t", size, alignment,
+                           API_NEW_ARRAY_ALIGNED, nothrow);
+}
+
+// operator delete(void *) and operator delete[](void *)
+void _ZdlPv(void *ptr) {
+    cxx_delete(ptr, DEALLOC_DELETE);
+}
+
+void _ZdaPv(void *ptr) {
+    cxx_delete(ptr, DEALLOC_DELETE_ARRAY);
+}
+
+// Sized delete (C++14)
+void _ZdlPvm(void *ptr, size_t size) {
+    (void)size;
+    cxx_delete(ptr, DEALLOC_DELETE);
+}
+
+void _ZdaPvm(void *ptr, size_t size) {
+    (void)size;
+    cxx_delete(ptr, DEALLOC_DELETE_ARRAY);
+}
+
+// Nothrow delete
+void _ZdlPvRKSt9nothrow_t(void *ptr, const void *nothrow) {
+    (void)nothrow;
+    cxx_delete(ptr, DEALLOC_DELETE);
+}
+
+void _ZdaPvRKSt9nothrow_t(void *ptr, const void *nothrow) {
+    (void)nothrow;
+    cxx_delete(ptr, DEALLOC_DELETE_ARRAY);
+}
+
+// Aligned delete (C++17), plain, sized and nothrow
+void _ZdlPvSt11align_val_t(void *ptr, size_t alignment) {
+    (void)alignment;
+    cxx_delete(ptr, DEALLOC_DELETE_ALIGNED);
+}
+
+void _ZdaPvSt11align_val_t(void *ptr, size_t alignment) {
+    (void)alignment;
+    cxx_delete(ptr, DEALLOC_DELETE_ARRAY_ALIGNED);
+}
+
+void _ZdlPvmSt11align_val_t(void *ptr, size_t size, size_t alignment) {
+    (void)size;
+    (void)alignment;
+    cxx_delete(ptr, DEALLOC_DELETE_ALIGNED);
+}
+
+void _ZdaPvmSt11align_val_t(void *ptr, size_t size, size_t alignment) {
+    (void)size;
+    (void)alignment;
+    cxx_delete(ptr, DEALLOC_DELETE_ARRAY_ALIGNED);
+}
+
+void _ZdlPvSt11align_val_tRKSt9nothrow_t(void *ptr, size_t alignment, const void *nothrow) {
+    (void)alignment;
+    (void)nothrow;
+    cxx_delete(ptr, DEALLOC_DELETE_ALIGNED);
+}
+
+void _ZdaPvSt11align_val_tRKSt9nothrow_t(void *ptr, size_t alignment, const void *nothrow) {
+    (void)alignment;
+    (void)nothrow;
+    cxx_delete(ptr, DEALLOC_DELETE_ARRAY_ALIGNED);
+}
+
 // Constructor - called when library is loaded
 __attribute__((constructor))
 static void memory_tracker_init() {
-    init_tracker();
+    pthread_once(&init_once, init_tracker);
+    if (unwind_mode == UNWIND_CFI) {
+        in_tracker = 1;
+        init_cfi_unwinder();
+        in_tracker = 0;
+    } else if (unwind_mode == UNWIND_BACKTRACE) {
+        // glibc loads libgcc_s on the first backtrace(); do it now rather
+        // than inside the first tracked allocation
+        void *frame;
+        in_tracker = 1;
+        backtrace(&frame, 1);
+        in_tracker = 0;
+    }
+    if (buffered_mode) {
+        start_aggregator();
+    }
+    if (snapshot_interval) {
+        start_snapshots();
+    }
+    if (stats_page) {
+        start_stats();
+    }
+
+    char *env = getenv("MEMTRACK_CONTROL");
+    if (initialized && env && *env) {
+        control_spec = env;
+        start_control(env);
+    }
 }
 
 // Destructor - called when library is unloaded
 __attribute__((destructor))
 static void memory_tracker_cleanup() {
     if (initialized) {
+        // Commands still arriving are ignored from here on
+        pthread_mutex_lock(&control_lock);
+        control_stopped = 1;
+        pthread_mutex_unlock(&control_lock);
+        if (control_path) {
+            unlink(control_path);
+        }
+
+        stop_snapshots();
+        if (buffered_mode) {
+            stop_aggregator();
+            drain_rings(1);
+        }
+        stop_stats();
+        if (quarantine_budget) {
+            quarantine_check_all();
+        }
         print_leak_report();
+        if (trace_fd >= 0) {
+            finish_trace();
+        }
     }
-}
\ No newline at end of file
+}
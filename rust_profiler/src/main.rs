@@ -8,9 +8,14 @@ use std::time::{Duration, Instant};
 use tokio::time;
 use tracing::{error, info, warn};
 
+// How long a new process gets to create its stats page before monitoring
+// falls back to /proc; one not running under libmemtrack never does
+const STATS_PAGE_WAIT: Duration = Duration::from_secs(1);
+
 mod memory_tracker;
 mod process_monitor;
 mod report_generator;
+mod shared_stats;
 
 use memory_tracker::MemoryTracker;
 use process_monitor::ProcessMonitor;
@@ -33,6 +38,9 @@ pub struct MemoryStats {
     pub allocation_count: u64,
     pub free_count: u64,
     pub active_allocations: HashMap<usize, AllocationInfo>,
+    /// Live blocks per power-of-two size class, from libmemtrack's stats page
+    #[serde(default)]
+    pub live_blocks_by_size_class: Vec<u64>,
 }
 
 #[derive(Debug, Serialize, Deserialize)]
@@ -106,8 +114,20 @@ async fn main() -> Result<()> {
                 .help("Show live memory statistics")
                 .takes_value(false),
         )
+        .arg(
+            Arg::new("clean-stats")
+                .long("clean-stats")
+                .help("Remove stats pages left in /dev/shm by exited processes, then exit")
+                .takes_value(false),
+        )
         .get_matches();
 
+    if matches.is_present("clean-stats") {
+        let removed = shared_stats::SharedStats::remove_stale();
+        println!("Removed {} stale stats page(s)", removed);
+        return Ok(());
+    }
+
     let output_file = matches.value_of("output").unwrap();
     let interval = matches
         .value_of("interval")
@@ -206,13 +226,27 @@ async fn profile_new_process(
 ) -> Result<()> {
     info!("Starting new process: {:?}", cmd_args);
 
+    // Ask libmemtrack, if the command runs under it, to publish its
+    // counters page; without the library the variable is ignored
     let mut child = tokio::process::Command::new(cmd_args[0])
         .args(&cmd_args[1..])
+        .env("MEMTRACK_STATS", "1")
         .spawn()
         .context("Failed to start process")?;
 
     let pid = child.id().context("Failed to get process ID")?;
     let monitor = ProcessMonitor::new(pid)?;
+
+    // libmemtrack creates the page in its constructor and unlinks it at
+    // exit, so map it now; a child that finishes before the first sample
+    // would otherwise leave nothing to read
+    let wait_start = Instant::now();
+    while !monitor.open_shared_stats() && wait_start.elapsed() < STATS_PAGE_WAIT {
+        if !matches!(child.try_wait(), Ok(None)) {
+            break;
+        }
+        time::sleep(Duration::from_millis(5)).await;
+    }
     let mut tracker = MemoryTracker::new();
     let start_time = chrono::Utc::now();
     let start_instant = Instant::now();
@@ -257,6 +291,12 @@ async fn profile_new_process(
         }
     }
 
+    // A page mapped while the process ran stays readable after it exits,
+    // with the numbers it had at exit
+    if let Ok(stats) = monitor.get_memory_stats().await {
+        tracker.update_stats(stats);
+    }
+
     let end_time = chrono::Utc::now();
     let command = cmd_args.join(" ");
 
@@ -280,6 +320,12 @@ fn print_live_stats(stats: &MemoryStats) {
     println!("Total Allocated: {} KB", stats.total_allocated / 1024);
     println!("Allocations: {}", stats.allocation_count);
     println!("Active Allocations: {}", stats.active_allocations.len());
+    for (class, blocks) in stats.live_blocks_by_size_class.iter().enumerate() {
+        if *blocks > 0 {
+            let upper = 1u64 << class;
+            println!("  Live blocks < {} B: {}", upper, blocks);
+        }
+    }
     println!("========================");
 }
 
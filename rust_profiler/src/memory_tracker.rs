@@ -17,6 +17,7 @@ impl MemoryTracker {
                 allocation_count: 0,
                 free_count: 0,
                 active_allocations: HashMap::new(),
+                live_blocks_by_size_class: Vec::new(),
             },
             peak_usage: 0,
         }
@@ -96,6 +97,7 @@ impl MemoryTracker {
             allocation_count: 0,
             free_count: 0,
             active_allocations: HashMap::new(),
+            live_blocks_by_size_class: Vec::new(),
         };
         self.peak_usage = 0;
     }
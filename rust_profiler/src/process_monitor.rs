@@ -1,11 +1,14 @@
+use crate::shared_stats::{LiveCounters, SharedStats};
 use crate::MemoryStats;
 use anyhow::{Context, Result};
 use procfs::process::Process;
 use std::collections::HashMap;
+use std::sync::Mutex;
 
 pub struct ProcessMonitor {
     pid: u32,
     process: Process,
+    shared_stats: Mutex<Option<SharedStats>>,
 }
 
 impl ProcessMonitor {
@@ -13,10 +16,49 @@ impl ProcessMonitor {
         let process = Process::new(pid as i32)
             .context(format!("Failed to attach to process {}", pid))?;
 
-        Ok(Self { pid, process })
+        Ok(Self {
+            pid,
+            process,
+            shared_stats: Mutex::new(None),
+        })
+    }
+
+    // Map libmemtrack's stats page if it exists; true once it is mapped
+    pub fn open_shared_stats(&self) -> bool {
+        let mut shared = match self.shared_stats.lock() {
+            Ok(shared) => shared,
+            Err(_) => return false,
+        };
+        if shared.is_none() {
+            *shared = SharedStats::open(SharedStats::default_path(self.pid)).ok();
+        }
+        shared.is_some()
+    }
+
+    // Counters from libmemtrack's stats page, mapped on first success
+    fn read_shared_stats(&self) -> Option<LiveCounters> {
+        if !self.open_shared_stats() {
+            return None;
+        }
+        self.shared_stats.lock().ok()?.as_ref()?.read().ok()
     }
 
     pub async fn get_memory_stats(&self) -> Result<MemoryStats> {
+        // Exact allocator counters when the process runs under libmemtrack
+        // with MEMTRACK_STATS=1
+        if let Some(counters) = self.read_shared_stats() {
+            return Ok(MemoryStats {
+                total_allocated: counters.total_allocated as usize,
+                total_freed: counters.total_freed as usize,
+                current_usage: counters.current_usage as usize,
+                peak_usage: counters.peak_usage as usize,
+                allocation_count: counters.allocation_count,
+                free_count: counters.free_count,
+                active_allocations: HashMap::new(), // The page carries counters, not blocks
+                live_blocks_by_size_class: counters.live_by_class,
+            });
+        }
+
         let stat = self.process.stat().context("Failed to read process stat")?;
         let statm = self.process.statm().context("Failed to read process statm")?;
         let status = self.process.status().context("Failed to read process status")?;
@@ -45,6 +87,7 @@ impl ProcessMonitor {
             allocation_count: 0, // Would need to track this separately
             free_count: 0,       // Would need to track this separately
             active_allocations: HashMap::new(), // Would need malloc/free hooking
+            live_blocks_by_size_class: Vec::new(),
         };
 
         Ok(stats)
@@ -0,0 +1,166 @@
+use anyhow::{bail, Context, Result};
+use std::fs::File;
+use std::os::unix::io::AsRawFd;
+use std::path::Path;
+use std::sync::atomic::{fence, AtomicU64, Ordering};
+use tracing::info;
+
+// Must match stats_page_t in memory_tracker/memory_tracker.c
+const STATS_MAGIC: &[u8; 8] = b"MEMSTATS";
+const STATS_VERSION: u32 = 1;
+const STATS_PAGE_SIZE: usize = 4096;
+const STATS_SIZE_CLASSES: usize = 32;
+const MAX_READ_ATTEMPTS: usize = 1000;
+
+#[repr(C)]
+#[derive(Clone, Copy)]
+#[allow(dead_code)] // Mirrors the C layout; not every field is consumed
+struct StatsPage {
+    magic: [u8; 8],
+    version: u32,
+    size_classes: u32,
+    pid: u64,
+    sequence: u64,
+    update_ns: u64,
+    exited: u32,
+    interval_ms: u32,
+    total_allocated: u64,
+    total_freed: u64,
+    current_usage: u64,
+    peak_usage: u64,
+    allocation_count: u64,
+    free_count: u64,
+    live_by_class: [u64; STATS_SIZE_CLASSES],
+    allocs_by_class: [u64; STATS_SIZE_CLASSES],
+}
+
+/// One consistent copy of the counters libmemtrack publishes
+#[derive(Debug, Clone)]
+pub struct LiveCounters {
+    pub total_allocated: u64,
+    pub total_freed: u64,
+    pub current_usage: u64,
+    /// Approximate: each thread batches up to 4 KiB of net change before it counts
+    pub peak_usage: u64,
+    pub allocation_count: u64,
+    pub free_count: u64,
+    /// Live blocks per size class; class c holds requests in [2^(c-1), 2^c) bytes
+    pub live_by_class: Vec<u64>,
+}
+
+/// Read-only mapping of the counters page libmemtrack writes when run with
+/// MEMTRACK_STATS=1. The mapping stays valid after the process exits and
+/// removes the file, so the final numbers can still be read.
+pub struct SharedStats {
+    page: *const StatsPage,
+}
+
+// The page is only ever read, through the sequence counter
+unsafe impl Send for SharedStats {}
+unsafe impl Sync for SharedStats {}
+
+impl SharedStats {
+    /// Default location used by a process started with MEMTRACK_STATS=1
+    pub fn default_path(pid: u32) -> String {
+        format!("/dev/shm/memtrack.{}", pid)
+    }
+
+    /// Remove default-path pages whose process is gone. A process that
+    /// crashes or leaves through _exit() never removes its page.
+    pub fn remove_stale() -> usize {
+        let entries = match std::fs::read_dir("/dev/shm") {
+            Ok(entries) => entries,
+            Err(_) => return 0,
+        };
+
+        let mut removed = 0;
+        for entry in entries.flatten() {
+            let name = entry.file_name();
+            let pid = match name
+                .to_str()
+                .and_then(|name| name.strip_prefix("memtrack."))
+                .and_then(|pid| pid.parse::<libc::pid_t>().ok())
+            {
+                Some(pid) if pid > 0 => pid,
+                _ => continue,
+            };
+            let alive = unsafe { libc::kill(pid, 0) } == 0
+                || std::io::Error::last_os_error().raw_os_error() != Some(libc::ESRCH);
+            if !alive && std::fs::remove_file(entry.path()).is_ok() {
+                info!("Removed stale stats page {:?} (PID {} has exited)", entry.path(), pid);
+                removed += 1;
+            }
+        }
+        removed
+    }
+
+    pub fn open<P: AsRef<Path>>(path: P) -> Result<Self> {
+        let file = File::open(path.as_ref())
+            .context(format!("Failed to open {:?}", path.as_ref()))?;
+        if file.metadata()?.len() < STATS_PAGE_SIZE as u64 {
+            bail!("Stats page is not initialized yet");
+        }
+
+        let page = unsafe {
+            libc::mmap(
+                std::ptr::null_mut(),
+                STATS_PAGE_SIZE,
+                libc::PROT_READ,
+                libc::MAP_SHARED,
+                file.as_raw_fd(),
+                0,
+            )
+        };
+        if page == libc::MAP_FAILED {
+            bail!("Failed to map stats page");
+        }
+
+        let stats = Self {
+            page: page as *const StatsPage,
+        };
+        let header = unsafe { std::ptr::read_volatile(stats.page) };
+        if &header.magic != STATS_MAGIC
+            || header.version != STATS_VERSION
+            || header.size_classes as usize != STATS_SIZE_CLASSES
+        {
+            bail!("Not a compatible libmemtrack stats page");
+        }
+        Ok(stats)
+    }
+
+    /// Copy the counters, retrying while the writer is mid-update
+    pub fn read(&self) -> Result<LiveCounters> {
+        let sequence = unsafe { &*(std::ptr::addr_of!((*self.page).sequence) as *const AtomicU64) };
+
+        for _ in 0..MAX_READ_ATTEMPTS {
+            let before = sequence.load(Ordering::Acquire);
+            if before & 1 == 1 {
+                std::hint::spin_loop();
+                continue;
+            }
+
+            let copy = unsafe { std::ptr::read_volatile(self.page) };
+            fence(Ordering::Acquire);
+            if sequence.load(Ordering::Relaxed) == before {
+                return Ok(LiveCounters {
+                    total_allocated: copy.total_allocated,
+                    total_freed: copy.total_freed,
+                    current_usage: copy.current_usage,
+                    peak_usage: copy.peak_usage,
+                    allocation_count: copy.allocation_count,
+                    free_count: copy.free_count,
+                    live_by_class: copy.live_by_class.to_vec(),
+                });
+            }
+        }
+        bail!("Stats page kept changing while being read")
+    }
+}
+
+impl Drop for SharedStats {
+    fn drop(&mut self) {
+        unsafe {
+            libc::munmap(self.page as *mut libc::c_void, STATS_PAGE_SIZE);
+        }
+    }
+}
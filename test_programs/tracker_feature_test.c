@@ -0,0 +1,156 @@
+/*
+ * Memory Tracker Feature Test Program
+ *
+ * This program exercises the allocation patterns the memory tracker's
+ * optional reports look at: repeated leaks from one callsite, aligned
+ * allocations, realloc growth, frees on another thread and many short-lived
+ * blocks. Extra arguments run steps that need the tracker's cooperation:
+ *   grow        leak steadily for a while (snapshots)
+ *   signal      raise SIGUSR2, then SIGUSR1 (MEMTRACK_CONTROL=signals)
+ *   fork        leak from a forked child
+ *   stats PATH  print the magic of the live counters page at PATH
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define THREAD_BLOCKS 8
+
+void repeated_leaks() {
+    printf("Leaking 40 blocks of 100 bytes...\n");
+    for (int i = 0; i < 40; i++) {
+        char *ptr = malloc(100);
+        memset(ptr, 'x', 100);
+    }
+}
+
+void sampled_leaks() {
+    printf("Leaking 1024 blocks of 16384 bytes...\n");
+    for (int i = 0; i < 1024; i++) {
+        char *ptr = malloc(16384);
+        ptr[0] = 'x';
+    }
+}
+
+void aligned_leaks() {
+    printf("Leaking aligned allocations...\n");
+    void *ptr = NULL;
+    if (posix_memalign(&ptr, 64, 96) != 0) {
+        printf("posix_memalign failed\n");
+    }
+    aligned_alloc(64, 128);
+    memalign(64, 160);
+}
+
+void realloc_growth() {
+    printf("Growing a buffer by doubling...\n");
+    char *buffer = malloc(16);
+    for (size_t size = 32; size <= 16384; size *= 2) {
+        buffer = realloc(buffer, size);
+        memset(buffer, 'x', size);
+    }
+    free(buffer);
+}
+
+void short_lived_blocks() {
+    printf("Allocating and freeing 50000 blocks...\n");
+    void **blocks = malloc(sizeof(void *) * 50000);
+    for (int i = 0; i < 50000; i++) {
+        blocks[i] = malloc(16 + i % 64);
+    }
+    for (int i = 0; i < 50000; i++) {
+        free(blocks[i]);
+    }
+    free(blocks);
+}
+
+void *produce_blocks(void *arg) {
+    void **blocks = arg;
+    for (int i = 0; i < THREAD_BLOCKS; i++) {
+        blocks[i] = malloc(32);
+    }
+    return NULL;
+}
+
+void cross_thread_frees() {
+    printf("Freeing %d blocks allocated on another thread...\n", THREAD_BLOCKS);
+    void *blocks[THREAD_BLOCKS];
+    pthread_t thread;
+    pthread_create(&thread, NULL, produce_blocks, blocks);
+    pthread_join(thread, NULL);
+    for (int i = 0; i < THREAD_BLOCKS; i++) {
+        free(blocks[i]);
+    }
+}
+
+void steady_growth() {
+    printf("Leaking 1024 bytes every 10 ms...\n");
+    for (int i = 0; i < 40; i++) {
+        char *ptr = malloc(1024);
+        ptr[0] = 'x';
+        usleep(10000);
+    }
+}
+
+void forked_leak() {
+    printf("Leaking 48 bytes in a forked child...\n");
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        char *ptr = malloc(48);
+        ptr[0] = 'x';
+        exit(0);
+    }
+    waitpid(pid, NULL, 0);
+}
+
+void print_stats_magic(const char *path) {
+    char magic[9] = {0};
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        printf("Stats page %s not found\n", path);
+        return;
+    }
+    if (fread(magic, 1, 8, file) != 8) {
+        printf("Stats page %s is short\n", path);
+    }
+    fclose(file);
+    printf("Stats page: %s\n", magic);
+}
+
+int main(int argc, char **argv) {
+    printf("=== Memory Tracker Feature Test Program ===\n");
+
+    repeated_leaks();
+    sampled_leaks();
+    aligned_leaks();
+    realloc_growth();
+    short_lived_blocks();
+    cross_thread_frees();
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "grow") == 0) {
+            steady_growth();
+        } else if (strcmp(argv[i], "signal") == 0) {
+            printf("Requesting a live report, then toggling tracking...\n");
+            raise(SIGUSR2);
+            usleep(100000);
+            raise(SIGUSR1);
+            usleep(100000);
+        } else if (strcmp(argv[i], "fork") == 0) {
+            forked_leak();
+        } else if (strcmp(argv[i], "stats") == 0 && i + 1 < argc) {
+            print_stats_magic(argv[++i]);
+        }
+    }
+
+    printf("Feature test completed\n");
+    return 0;
+}